@@ -0,0 +1,97 @@
+#include "BatchRenderer.h"
+#include "FrameArena.h"
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+BatchRenderer::BatchRenderer(const Renderer& source, SDL_Surface* screen, int workers)
+	: source(source)
+{
+	if (workers <= 0)
+		workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	for (int i = 0; i < workers; ++i)
+		renderers.emplace_back(screen);
+	for (int i = 0; i < workers * IMAGES_PER_WORKER; ++i)
+		images.emplace_back(screen);
+}
+
+void BatchRenderer::run(int frameCount, const RenderFunc& renderFrame, const OutputFunc& output)
+{
+	for (auto& renderer : renderers)
+	{
+		renderer.shareBuffers(source);
+		renderer.setVertexShader(source.getVertexShader(), source.getVaryingCount());
+		renderer.setFragmentShader(source.getFragmentShader());
+		if (renderer.getSampleCount() != source.getSampleCount())
+			renderer.setSampleCount(source.getSampleCount());
+		if (renderer.getDepthFormat() != source.getDepthFormat())
+			renderer.setDepthFormat(source.getDepthFormat());
+	}
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<int> freeImages;
+	std::unordered_map<int, int> readyImages;		// frame -> image
+	int nextFrame = 0;
+	for (int i = 0; i < static_cast<int>(images.size()); ++i)
+		freeImages.push_back(i);
+
+	auto work = [&](int worker) {
+		auto& renderer = renderers[worker];
+		while (true)
+		{
+			int frame = -1;
+			int image = -1;
+			{
+				// the image is taken before the frame, so the oldest frame not done always has one
+				std::unique_lock<std::mutex> lock(mtx);
+				cv.wait(lock, [&] { return nextFrame >= frameCount || !freeImages.empty(); });
+				if (nextFrame >= frameCount)
+					return;
+				image = freeImages.front();
+				freeImages.pop_front();
+				frame = nextFrame++;
+			}
+
+			renderer.setRenderTarget(images[image]);
+			renderFrame(renderer, frame, worker);
+			FrameArena::local().reset();
+
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				readyImages[frame] = image;
+			}
+			cv.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < getWorkerCount(); ++i)
+		threads.emplace_back(work, i);
+
+	for (int frame = 0; frame < frameCount; ++frame)
+	{
+		int image = -1;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [&] { return readyImages.count(frame) > 0; });
+			image = readyImages[frame];
+			readyImages.erase(frame);
+		}
+
+		output(frame, images[image]);
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			freeImages.push_back(image);
+		}
+		cv.notify_all();
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+}
\ No newline at end of file
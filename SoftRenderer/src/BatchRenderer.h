@@ -0,0 +1,40 @@
+#ifndef M_BATCH_RENDERER_H
+#define M_BATCH_RENDERER_H
+
+#include <SDL.h>
+#include "Renderer.h"
+#include "Texture.h"
+#include <vector>
+#include <functional>
+
+// renders the frames of a clip offline, several at once: every worker thread has its own renderer,
+// color and depth buffers, the meshes and textures are shared read-only. finished frames wait in a
+// reorder buffer until the ones before them are out, so they are handed over in order.
+class BatchRenderer
+{
+public:
+	// draw frame with renderer, the worker's own, already targeting a free image.
+	// worker : 0 .. getWorkerCount() - 1, to keep per-thread state such as shadow maps.
+	// the worker's FrameArena is reset after each frame
+	using RenderFunc = std::function<void(Renderer& renderer, int frame, int worker)>;
+	// gets the finished images in frame order, on the thread that called run()
+	using OutputFunc = std::function<void(int frame, Texture& image)>;
+
+	// screen : format and size of the images. workers : 0 for one per core
+	BatchRenderer(const Renderer& source, SDL_Surface* screen, int workers = 0);
+
+	// the workers pick up the buffers, shaders and sample count of source
+	void run(int frameCount, const RenderFunc& renderFrame, const OutputFunc& output);
+
+	int getWorkerCount() const { return static_cast<int>(renderers.size()); };
+
+private:
+	// images per worker, how far the frames can get ahead of the oldest one not yet done
+	static const int IMAGES_PER_WORKER = 2;
+
+	const Renderer& source;
+	std::vector<Renderer> renderers;
+	std::vector<Texture> images;
+};
+
+#endif
\ No newline at end of file
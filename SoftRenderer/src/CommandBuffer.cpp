@@ -0,0 +1,113 @@
+#include "CommandBuffer.h"
+#include "Material.h"
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+int CommandBuffer::addShader(std::function<Vector4f(VertexShaderParams&)> vs, int varyingCount, std::function<Vector4f(FragmentShaderParams&)> fs)
+{
+	shaders.push_back({ vs, varyingCount, fs });
+	return static_cast<int>(shaders.size()) - 1;
+}
+
+void CommandBuffer::clear()
+{
+	// the records stay allocated, recording into them again reuses their vectors
+	count = 0;
+	order.clear();
+	sorted = true;
+}
+
+void CommandBuffer::draw(const DrawParams& param, int shaderId)
+{
+	if (count == static_cast<int>(commands.size()))
+		commands.emplace_back();
+
+	auto& cmd = commands[count++];
+	cmd.param = param;
+	cmd.shaderId = shaderId;
+	cmd.key = makeKey(param, shaderId);
+	sorted = false;
+}
+
+// shader : 8 bits | diffuse texture : 12 bits | specular texture : 12 bits | depth : 32 bits
+uint64_t CommandBuffer::makeKey(const DrawParams& param, int shaderId)
+{
+	auto textureKey = [](int idx) -> uint64_t {
+		return static_cast<uint64_t>(std::min(idx + 1, 0xfff));
+	};
+
+	// nearest point of the bounding sphere, positive in front of the camera
+	auto center = param.vsParams.mv * Vector4f{ param.boundCenter.x, param.boundCenter.y, param.boundCenter.z, 1.f };
+	float depth = std::max(0.f, -center.z - param.boundRadius);
+
+	// the bits of a positive float sort like the float
+	uint32_t depthBits;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	uint64_t key = static_cast<uint64_t>(std::min(shaderId + 1, 0xff)) << 56;
+	// a material's own textures, draws of a material run its shader variant back to back
+	const auto& fsp = param.fsParams;
+	key |= textureKey(fsp.material != nullptr ? fsp.material->diffuseTextureIdx : fsp.diffuseTextureIdx) << 44;
+	key |= textureKey(fsp.material != nullptr ? fsp.material->specularTextureIdx : fsp.specularTextureIdx) << 32;
+	key |= depthBits;
+	return key;
+}
+
+void CommandBuffer::sort()
+{
+	if (sorted)
+		return;
+
+	order.resize(count);
+	std::iota(order.begin(), order.end(), 0);
+	// draws with the same key keep the recorded order. not stable_sort, it allocates a buffer
+	std::sort(order.begin(), order.end(), [this](int a, int b) {
+		return commands[a].key < commands[b].key || (commands[a].key == commands[b].key && a < b);
+	});
+	sorted = true;
+}
+
+void CommandBuffer::execute(Renderer& renderer)
+{
+	sort();
+
+	auto vs = renderer.getVertexShader();
+	auto varyingCount = renderer.getVaryingCount();
+	auto fs = renderer.getFragmentShader();
+
+	int bound = -1;
+	for (int idx : order)
+	{
+		auto& cmd = commands[idx];
+		int shaderId = cmd.shaderId >= 0 && cmd.shaderId < static_cast<int>(shaders.size()) ? cmd.shaderId : -1;
+		if (shaderId != bound)
+		{
+			if (shaderId == -1)
+			{
+				renderer.setVertexShader(vs, varyingCount);
+				renderer.setFragmentShader(fs);
+			}
+			else
+			{
+				renderer.setVertexShader(shaders[shaderId].vs, shaders[shaderId].varyingCount);
+				renderer.setFragmentShader(shaders[shaderId].fs);
+			}
+			bound = shaderId;
+		}
+		renderer.draw(cmd.param);
+	}
+
+	if (bound != -1)
+	{
+		renderer.setVertexShader(vs, varyingCount);
+		renderer.setFragmentShader(fs);
+	}
+}
+
+void CommandBuffer::execute(const std::function<void(DrawParams&)>& drawFunc)
+{
+	sort();
+	for (int idx : order)
+		drawFunc(commands[idx].param);
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef M_COMMAND_BUFFER_H
+#define M_COMMAND_BUFFER_H
+
+#include "Renderer.h"
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+// records draws, sorts them by shader, textures and front-to-back depth, then replays them.
+// the recorded draws are kept until clear(), a static scene can execute the same buffer every frame.
+class CommandBuffer
+{
+public:
+	// a shader pair draws can refer to, returns its id
+	int addShader(std::function<Vector4f(VertexShaderParams&)> vs, int varyingCount, std::function<Vector4f(FragmentShaderParams&)> fs);
+
+	void clear();
+	// records a copy of param, shaderId -1 keeps whatever shaders the renderer has bound
+	void draw(const DrawParams& param, int shaderId = -1);
+	// sorts the draws, execute does it too if needed
+	void sort();
+
+	// binds the shader of every draw, then restores the shaders the renderer had
+	void execute(Renderer& renderer);
+	// hands every draw in sorted order to drawFunc, e.g. a shadow map
+	void execute(const std::function<void(DrawParams&)>& drawFunc);
+
+	int size() const { return count; };
+
+private:
+	struct Shader
+	{
+		std::function<Vector4f(VertexShaderParams&)> vs;
+		int varyingCount;
+		std::function<Vector4f(FragmentShaderParams&)> fs;
+	};
+
+	struct Command
+	{
+		DrawParams param;
+		int shaderId;
+		uint64_t key;
+	};
+
+	std::vector<Shader> shaders;
+	std::vector<Command> commands;		// the first count are recorded
+	int count = 0;
+	std::vector<int> order;				// sorted indices into commands
+	bool sorted = true;
+
+	static uint64_t makeKey(const DrawParams& param, int shaderId);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "DepthBuffer.h"
+#include <algorithm>
+#include <cmath>
+
+void DepthBuffer::allocate(int width, int height, int samples, DepthFormat format)
+{
+	this->width = width;
+	this->height = height;
+	this->samples = samples;
+	this->format = format;
+	tileCols = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t size = static_cast<size_t>(tileCols) * tileRows * TILE_SIZE * TILE_SIZE * samples;
+
+	depth32f.clear();
+	depth24.clear();
+	depth16.clear();
+	depth32f.shrink_to_fit();
+	depth24.shrink_to_fit();
+	depth16.shrink_to_fit();
+	if (format == DepthFormat::D32F)
+		depth32f.resize(size);
+	else if (format == DepthFormat::D24)
+		depth24.resize(size);
+	else
+		depth16.resize(size);
+	tileCleared.assign(tileCols * tileRows, 1);
+}
+
+void DepthBuffer::setRange(float zNear, float zFar)
+{
+	this->zNear = zNear;
+	this->zFar = zFar;
+	scale = zFar > zNear ? 1.f / (zFar - zNear) : 0.f;
+}
+
+void DepthBuffer::clear()
+{
+	std::fill(tileCleared.begin(), tileCleared.end(), 1);
+}
+
+void DepthBuffer::clear(int x0, int y0, int x1, int y1)
+{
+	for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ++ty)
+	{
+		for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; ++tx)
+		{
+			int tile = ty * tileCols + tx;
+			int tileX0 = tx * TILE_SIZE;
+			int tileY0 = ty * TILE_SIZE;
+			bool inside = tileX0 >= x0 && tileY0 >= y0 && tileX0 + TILE_SIZE - 1 <= x1 && tileY0 + TILE_SIZE - 1 <= y1;
+			if (inside || tileCleared[tile])
+			{
+				tileCleared[tile] = 1;
+				continue;
+			}
+
+			// zero the part of the tile in the rect, the rest keeps its depth
+			for (int y = std::max(y0, tileY0); y <= std::min(y1, tileY0 + TILE_SIZE - 1); ++y)
+			{
+				for (int x = std::max(x0, tileX0); x <= std::min(x1, tileX0 + TILE_SIZE - 1); ++x)
+				{
+					int offset = getOffset(x, y);
+					if (format == DepthFormat::D32F)
+						std::fill_n(&depth32f[offset], samples, 0.f);
+					else if (format == DepthFormat::D24)
+						std::fill_n(&depth24[offset], samples, 0u);
+					else
+						std::fill_n(&depth16[offset], samples, static_cast<uint16_t>(0));
+				}
+			}
+		}
+	}
+}
+
+void DepthBuffer::fillTile(int tile)
+{
+	int size = TILE_SIZE * TILE_SIZE * samples;
+	int offset = tile * size;
+	if (format == DepthFormat::D32F)
+		std::fill_n(&depth32f[offset], size, 0.f);
+	else if (format == DepthFormat::D24)
+		std::fill_n(&depth24[offset], size, 0u);
+	else
+		std::fill_n(&depth16[offset], size, static_cast<uint16_t>(0));
+	tileCleared[tile] = 0;
+}
+
+float DepthBuffer::getDepth(int x, int y, int sample) const
+{
+	if (tileCleared[getTile(x, y)])
+		return 0.f;
+
+	int offset = getOffset(x, y) + sample;
+	if (format == DepthFormat::D32F)
+		return depth32f[offset];
+
+	float u = format == DepthFormat::D24 ? depth24[offset] / DEPTH24_MAX : depth16[offset] / DEPTH16_MAX;
+	if (u <= 0.f)
+		return 0.f;
+	return zNear + u * (zFar - zNear);
+}
\ No newline at end of file
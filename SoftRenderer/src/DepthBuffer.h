@@ -0,0 +1,134 @@
+#ifndef M_DEPTH_BUFFER_H
+#define M_DEPTH_BUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+const float DEPTH16_MAX = 65535.f;
+const float DEPTH24_MAX = 16777215.f;
+
+// how depth is stored. the fixed-point formats map [zNear, zFar] of the draws to [0, 1]
+enum class DepthFormat
+{
+	D16,			// 16 bit unorm, half the memory of the others
+	D24,			// 24 bit unorm in 32 bits, the same precision over the whole range
+	D32F,			// the values of the rasterizer as they are
+};
+
+// the samples of one pixel, as they are stored
+class DepthSamples
+{
+public:
+	DepthSamples(void* data, DepthFormat format, float offset, float scale) : data(data), format(format), offset(offset), scale(scale) {};
+
+	// larger is closer. equal: passes only on the stored value and writes nothing, for after a depth pre-pass
+	inline bool test(int sample, float z, bool equal);
+
+private:
+	void* data;
+	DepthFormat format;
+	float offset;
+	float scale;
+};
+
+// depth of every sample in 8x8 pixel tiles, each tile contiguous. a clear only flags the tiles,
+// the first access to a flagged tile writes the clear value into it.
+class DepthBuffer
+{
+public:
+	static const int TILE_SHIFT = 3;
+	static const int TILE_SIZE = 1 << TILE_SHIFT;
+
+	void allocate(int width, int height, int samples, DepthFormat format);
+	DepthFormat getFormat() const { return format; };
+	// the range of the depth values quantized by the fixed-point formats, the draws sharing the buffer share it
+	void setRange(float zNear, float zFar);
+
+	// every sample to 0, farther than anything. o(tiles)
+	void clear();
+	// the tiles inside the rect are flagged, the pixels of the ones across its edges are cleared
+	void clear(int x0, int y0, int x1, int y1);
+
+	// for the depth test, clears the tile first if it is flagged
+	DepthSamples getSamples(int x, int y)
+	{
+		int tile = getTile(x, y);
+		if (tileCleared[tile])
+			fillTile(tile);
+		return DepthSamples(getData(getOffset(x, y)), format, zNear, scale);
+	};
+	// 0 where nothing was drawn
+	float getDepth(int x, int y, int sample) const;
+
+private:
+	int width = 0;
+	int height = 0;
+	int samples = 1;
+	int tileCols = 0;
+	DepthFormat format = DepthFormat::D32F;
+	float zNear = 0.f;
+	float zFar = 1.f;
+	float scale = 1.f;			// 1 / (zFar - zNear)
+
+	// one of them, for the format
+	std::vector<float> depth32f;
+	std::vector<uint32_t> depth24;
+	std::vector<uint16_t> depth16;
+	std::vector<uint8_t> tileCleared;
+
+	int getTile(int x, int y) const { return (y >> TILE_SHIFT) * tileCols + (x >> TILE_SHIFT); };
+	int getOffset(int x, int y) const
+	{
+		int inTile = ((y & (TILE_SIZE - 1)) << TILE_SHIFT) + (x & (TILE_SIZE - 1));
+		return ((getTile(x, y) << (2 * TILE_SHIFT)) + inTile) * samples;
+	};
+	void* getData(int offset)
+	{
+		if (format == DepthFormat::D32F)
+			return &depth32f[offset];
+		if (format == DepthFormat::D24)
+			return &depth24[offset];
+		return &depth16[offset];
+	};
+	void fillTile(int tile);
+};
+
+inline bool DepthSamples::test(int sample, float z, bool equal)
+{
+	if (format == DepthFormat::D32F)
+	{
+		float* depth = static_cast<float*>(data);
+		if (equal)
+			return z == depth[sample];
+		if (z <= depth[sample])
+			return false;
+		depth[sample] = z;
+		return true;
+	}
+
+	// 0 is kept for the clear value, what is quantized to it is at the far plane anyway
+	float u = std::min(std::max((z - offset) * scale, 0.f), 1.f);
+	if (format == DepthFormat::D24)
+	{
+		uint32_t* depth = static_cast<uint32_t*>(data);
+		auto q = static_cast<uint32_t>(u * DEPTH24_MAX + 0.5f);
+		if (equal)
+			return q == depth[sample];
+		if (q <= depth[sample])
+			return false;
+		depth[sample] = q;
+		return true;
+	}
+
+	uint16_t* depth = static_cast<uint16_t*>(data);
+	auto q = static_cast<uint16_t>(u * DEPTH16_MAX + 0.5f);
+	if (equal)
+		return q == depth[sample];
+	if (q <= depth[sample])
+		return false;
+	depth[sample] = q;
+	return true;
+}
+
+#endif
\ No newline at end of file
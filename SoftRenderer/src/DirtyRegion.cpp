@@ -0,0 +1,111 @@
+#include "DirtyRegion.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void DirtyRegion::beginFrame(bool full)
+{
+	++frame;
+	this->full = full;
+	dirty = ScreenRect();
+}
+
+void DirtyRegion::addDraw(int key, const ScreenRect& rect, uint64_t signature)
+{
+	auto& draw = draws[key];
+	if (!draw.drawn)
+	{
+		dirty = ScreenRect::merge(dirty, rect);
+	}
+	else if (draw.signature != signature)
+	{
+		dirty = ScreenRect::merge(dirty, draw.rect);
+		dirty = ScreenRect::merge(dirty, rect);
+	}
+	draw.rect = rect;
+	draw.signature = signature;
+	draw.frame = frame;
+	draw.drawn = true;
+}
+
+ScreenRect DirtyRegion::endFrame(int target, int width, int height)
+{
+	// what was drawn last frame and not this one leaves its pixels behind.
+	// the entry is kept for when it comes back, so a steady scene never allocates
+	for (auto& it : draws)
+	{
+		auto& draw = it.second;
+		if (draw.drawn && draw.frame != frame)
+		{
+			dirty = ScreenRect::merge(dirty, draw.rect);
+			draw.drawn = false;
+		}
+	}
+
+	ScreenRect screen;
+	screen.x1 = width - 1;
+	screen.y1 = height - 1;
+	if (full)
+		dirty = screen;
+
+	history[frame % MAX_HISTORY] = dirty;
+	if (historyCount < MAX_HISTORY)
+		++historyCount;
+
+	// everything since the target was last drawn into, the frames before are already in it
+	auto last = targetFrames.find(target);
+	int age = last == targetFrames.end() ? MAX_HISTORY + 1 : frame - last->second;
+	targetFrames[target] = frame;
+	if (age > historyCount)
+		return screen;
+
+	ScreenRect redraw;
+	for (int i = 0; i < age; ++i)
+		redraw = ScreenRect::merge(redraw, history[(frame - i) % MAX_HISTORY]);
+	return ScreenRect::intersect(redraw, screen);
+}
+
+uint64_t DirtyRegion::hash(const void* data, size_t size, uint64_t seed)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		seed ^= bytes[i];
+		seed *= 1099511628211ull;
+	}
+	return seed;
+}
+
+ScreenRect DirtyRegion::getScreenRect(const Vector4f* viewPoints, int count, const Matrix4f& projection, float zNear, int width, int height)
+{
+	ScreenRect screen;
+	screen.x1 = width - 1;
+	screen.y1 = height - 1;
+
+	float xMin = std::numeric_limits<float>::max();
+	float yMin = std::numeric_limits<float>::max();
+	float xMax = std::numeric_limits<float>::lowest();
+	float yMax = std::numeric_limits<float>::lowest();
+	for (int k = 0; k < count; ++k)
+	{
+		// the camera faces -z, the projection of a point behind the near plane is unbounded
+		if (viewPoints[k].z > -zNear)
+			return screen;
+
+		auto clip = projection * viewPoints[k];
+		float x = (clip.x / clip.w + 1.f) / 2 * width;
+		float y = (clip.y / clip.w + 1.f) / 2 * height;
+		xMin = std::min(xMin, x);
+		xMax = std::max(xMax, x);
+		yMin = std::min(yMin, y);
+		yMax = std::max(yMax, y);
+	}
+
+	// the pixels whose sample positions may fall inside, clamping first keeps the casts in range
+	ScreenRect rect;
+	rect.x0 = static_cast<int>(std::floor(std::max(xMin, -1.f)));
+	rect.y0 = static_cast<int>(std::floor(std::max(yMin, -1.f)));
+	rect.x1 = static_cast<int>(std::floor(std::min(xMax, static_cast<float>(width))));
+	rect.y1 = static_cast<int>(std::floor(std::min(yMax, static_cast<float>(height))));
+	return ScreenRect::intersect(rect, screen);
+}
\ No newline at end of file
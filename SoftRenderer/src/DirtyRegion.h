@@ -0,0 +1,49 @@
+#ifndef M_DIRTY_REGION_H
+#define M_DIRTY_REGION_H
+
+#include "Math.h"
+#include "Renderer.h"
+#include <unordered_map>
+#include <cstdint>
+
+// the part of the screen that has to be redrawn when most of the view stays the same.
+// every draw of a frame is reported with its screen rect and a signature of what it depends on,
+// the old and new rects of the draws that changed, appeared or went away are dirty. the render
+// targets are reused in turn, so a target also gets what changed since it was last drawn into.
+class DirtyRegion
+{
+public:
+	// full : something that touches every pixel changed, e.g. the camera or the resolution
+	void beginFrame(bool full);
+	// key : the same for a draw from frame to frame
+	void addDraw(int key, const ScreenRect& rect, uint64_t signature);
+	// the rect to clear and redraw in target (FramePipeline::Target::index), the rest of it is up to date
+	ScreenRect endFrame(int target, int width, int height);
+
+	// fnv-1a, chain calls through seed
+	static uint64_t hash(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+	// the pixels covered by the projection of view-space points, the whole screen if one is not in front of zNear
+	static ScreenRect getScreenRect(const Vector4f* viewPoints, int count, const Matrix4f& projection, float zNear, int width, int height);
+
+private:
+	struct Draw
+	{
+		ScreenRect rect;
+		uint64_t signature = 0;
+		int frame = 0;			// last reported in
+		bool drawn = false;		// in the last frame
+	};
+
+	// how many past frames are remembered, a target left alone longer is redrawn whole
+	static const int MAX_HISTORY = 8;
+
+	std::unordered_map<int, Draw> draws;
+	ScreenRect history[MAX_HISTORY];			// dirty rect of the last frames, frame f at f % MAX_HISTORY
+	int historyCount = 0;
+	std::unordered_map<int, int> targetFrames;	// target -> frame it was last drawn in
+	ScreenRect dirty;
+	bool full = true;
+	int frame = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "DynamicBvh.h"
+#include "FrameArena.h"
+#include <algorithm>
+
+Aabb Aabb::merge(const Aabb& a, const Aabb& b)
+{
+	Aabb res;
+	res.min = Vector3f(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z));
+	res.max = Vector3f(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z));
+	return res;
+}
+
+bool Aabb::contains(const Aabb& b) const
+{
+	return min.x <= b.min.x && min.y <= b.min.y && min.z <= b.min.z &&
+		max.x >= b.max.x && max.y >= b.max.y && max.z >= b.max.z;
+}
+
+float Aabb::area() const
+{
+	auto d = max - min;
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+Frustum Frustum::fromMatrix(const Matrix4f& m, bool orthographic)
+{
+	auto row = [&m](int i) {
+		return Vector4f{ m.num[i * 4], m.num[i * 4 + 1], m.num[i * 4 + 2], m.num[i * 4 + 3] };
+	};
+	auto r0 = row(0);
+	auto r1 = row(1);
+	auto r2 = row(2);
+	auto r3 = row(3);
+
+	// the perspective matrix of this renderer gives w = z of view space, negative in front of the camera,
+	// the planes are symmetric so it is enough to take w with the sign that is positive in front.
+	// it can't be told from a sample point, the point may be anywhere once the camera moves
+	auto w = orthographic ? r3 : -1.f * r3;
+
+	Frustum res;
+	res.planes[0] = w + r0;
+	res.planes[1] = w - r0;
+	res.planes[2] = w + r1;
+	res.planes[3] = w - r1;
+	res.planes[4] = w + r2;
+	res.planes[5] = w - r2;
+	return res;
+}
+
+Frustum::Result Frustum::test(const Aabb& box) const
+{
+	auto result = Result::Inside;
+	for (const auto& p : planes)
+	{
+		// the corners furthest along and against the normal
+		Vector3f pv(p.x >= 0 ? box.max.x : box.min.x, p.y >= 0 ? box.max.y : box.min.y, p.z >= 0 ? box.max.z : box.min.z);
+		Vector3f nv(p.x >= 0 ? box.min.x : box.max.x, p.y >= 0 ? box.min.y : box.max.y, p.z >= 0 ? box.min.z : box.max.z);
+		if (p.x * pv.x + p.y * pv.y + p.z * pv.z + p.w < 0.f)
+			return Result::Outside;
+		if (p.x * nv.x + p.y * nv.y + p.z * nv.z + p.w < 0.f)
+			result = Result::Intersect;
+	}
+	return result;
+}
+
+int DynamicBvh::allocateNode()
+{
+	if (freeList == -1)
+	{
+		nodes.emplace_back();
+		freeList = static_cast<int>(nodes.size()) - 1;
+		nodes[freeList].parent = -1;
+	}
+
+	int idx = freeList;
+	freeList = nodes[idx].parent;
+	nodes[idx] = Node();
+	nodes[idx].height = 0;
+	return idx;
+}
+
+void DynamicBvh::freeNode(int idx)
+{
+	nodes[idx].parent = freeList;
+	nodes[idx].height = -1;
+	freeList = idx;
+}
+
+int DynamicBvh::insert(const Aabb& box, int userData)
+{
+	int leaf = allocateNode();
+	auto d = margin * (box.max - box.min);
+	nodes[leaf].box.min = box.min - d;
+	nodes[leaf].box.max = box.max + d;
+	nodes[leaf].userData = userData;
+	insertLeaf(leaf);
+	return leaf;
+}
+
+void DynamicBvh::remove(int proxy)
+{
+	removeLeaf(proxy);
+	freeNode(proxy);
+}
+
+bool DynamicBvh::move(int proxy, const Aabb& box)
+{
+	if (nodes[proxy].box.contains(box))
+		return false;
+
+	removeLeaf(proxy);
+	auto d = margin * (box.max - box.min);
+	nodes[proxy].box.min = box.min - d;
+	nodes[proxy].box.max = box.max + d;
+	insertLeaf(proxy);
+	return true;
+}
+
+void DynamicBvh::insertLeaf(int leaf)
+{
+	if (root == -1)
+	{
+		root = leaf;
+		nodes[root].parent = -1;
+		return;
+	}
+
+	// walk down to the sibling with the cheapest surface area increase
+	Aabb leafBox = nodes[leaf].box;
+	int idx = root;
+	while (!nodes[idx].isLeaf())
+	{
+		int c1 = nodes[idx].child1;
+		int c2 = nodes[idx].child2;
+
+		float area = nodes[idx].box.area();
+		float combinedArea = Aabb::merge(nodes[idx].box, leafBox).area();
+
+		// cost of making a new parent of this node and the leaf
+		float cost = 2.f * combinedArea;
+		// every ancestor grows by that much whichever child we descend in
+		float inheritance = 2.f * (combinedArea - area);
+
+		auto descendCost = [&](int child) {
+			float merged = Aabb::merge(leafBox, nodes[child].box).area();
+			if (nodes[child].isLeaf())
+				return merged + inheritance;
+			return merged - nodes[child].box.area() + inheritance;
+		};
+		float cost1 = descendCost(c1);
+		float cost2 = descendCost(c2);
+
+		if (cost < cost1 && cost < cost2)
+			break;
+		idx = cost1 < cost2 ? c1 : c2;
+	}
+
+	int sibling = idx;
+	int oldParent = nodes[sibling].parent;
+	int newParent = allocateNode();
+	nodes[newParent].parent = oldParent;
+	nodes[newParent].box = Aabb::merge(leafBox, nodes[sibling].box);
+	nodes[newParent].height = nodes[sibling].height + 1;
+	nodes[newParent].child1 = sibling;
+	nodes[newParent].child2 = leaf;
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+
+	if (oldParent == -1)
+		root = newParent;
+	else if (nodes[oldParent].child1 == sibling)
+		nodes[oldParent].child1 = newParent;
+	else
+		nodes[oldParent].child2 = newParent;
+
+	refit(nodes[leaf].parent);
+}
+
+void DynamicBvh::removeLeaf(int leaf)
+{
+	if (leaf == root)
+	{
+		root = -1;
+		return;
+	}
+
+	int parent = nodes[leaf].parent;
+	int grandParent = nodes[parent].parent;
+	int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+	if (grandParent == -1)
+	{
+		root = sibling;
+		nodes[sibling].parent = -1;
+		freeNode(parent);
+		return;
+	}
+
+	if (nodes[grandParent].child1 == parent)
+		nodes[grandParent].child1 = sibling;
+	else
+		nodes[grandParent].child2 = sibling;
+	nodes[sibling].parent = grandParent;
+	freeNode(parent);
+
+	refit(grandParent);
+}
+
+// rebalance and recompute the boxes and heights from idx up to the root
+void DynamicBvh::refit(int idx)
+{
+	while (idx != -1)
+	{
+		idx = balance(idx);
+
+		auto& node = nodes[idx];
+		node.height = 1 + std::max(nodes[node.child1].height, nodes[node.child2].height);
+		node.box = Aabb::merge(nodes[node.child1].box, nodes[node.child2].box);
+		idx = node.parent;
+	}
+}
+
+// if the children of a differ in height by more than one, the taller child takes the place of a
+// and a keeps the shorter grandchild
+int DynamicBvh::balance(int iA)
+{
+	if (nodes[iA].isLeaf() || nodes[iA].height < 2)
+		return iA;
+
+	int iB = nodes[iA].child1;
+	int iC = nodes[iA].child2;
+	int diff = nodes[iC].height - nodes[iB].height;
+	if (diff >= -1 && diff <= 1)
+		return iA;
+
+	bool rotateC = diff > 1;
+	int iUp = rotateC ? iC : iB;
+	int iStay = rotateC ? iB : iC;
+	Node& A = nodes[iA];
+	Node& up = nodes[iUp];
+
+	int iF = up.child1;
+	int iG = up.child2;
+
+	up.child1 = iA;
+	up.parent = A.parent;
+	A.parent = iUp;
+
+	if (up.parent == -1)
+		root = iUp;
+	else if (nodes[up.parent].child1 == iA)
+		nodes[up.parent].child1 = iUp;
+	else
+		nodes[up.parent].child2 = iUp;
+
+	int iTall = nodes[iF].height > nodes[iG].height ? iF : iG;
+	int iShort = iTall == iF ? iG : iF;
+
+	up.child2 = iTall;
+	if (rotateC)
+		A.child2 = iShort;
+	else
+		A.child1 = iShort;
+	nodes[iShort].parent = iA;
+
+	A.box = Aabb::merge(nodes[iStay].box, nodes[iShort].box);
+	A.height = 1 + std::max(nodes[iStay].height, nodes[iShort].height);
+	up.box = Aabb::merge(A.box, nodes[iTall].box);
+	up.height = 1 + std::max(A.height, nodes[iTall].height);
+	return iUp;
+}
+
+void DynamicBvh::traverse(const std::function<bool(const Aabb&)>& enter, const std::function<void(int userData)>& visit) const
+{
+	if (root == -1)
+		return;
+
+	FrameVector<int> stack = { root };
+	while (!stack.empty())
+	{
+		int idx = stack.back();
+		stack.pop_back();
+
+		const auto& node = nodes[idx];
+		if (!enter(node.box))
+			continue;
+
+		if (node.isLeaf())
+		{
+			visit(node.userData);
+		}
+		else
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
+
+void DynamicBvh::queryFrustum(const Frustum& frustum, std::vector<int>& result) const
+{
+	if (root == -1)
+		return;
+
+	FrameVector<int> stack = { root };
+	while (!stack.empty())
+	{
+		int idx = stack.back();
+		stack.pop_back();
+
+		const auto& node = nodes[idx];
+		auto res = frustum.test(node.box);
+		if (res == Frustum::Result::Outside)
+			continue;
+
+		if (res == Frustum::Result::Inside)
+		{
+			collectLeaves(idx, result);
+		}
+		else if (node.isLeaf())
+		{
+			result.push_back(node.userData);
+		}
+		else
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
+
+void DynamicBvh::collectLeaves(int idx, std::vector<int>& result) const
+{
+	const auto& node = nodes[idx];
+	if (node.isLeaf())
+	{
+		result.push_back(node.userData);
+		return;
+	}
+	collectLeaves(node.child1, result);
+	collectLeaves(node.child2, result);
+}
\ No newline at end of file
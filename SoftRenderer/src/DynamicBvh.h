@@ -0,0 +1,87 @@
+#ifndef M_DYNAMIC_BVH_H
+#define M_DYNAMIC_BVH_H
+
+#include "Math.h"
+#include <vector>
+#include <functional>
+
+struct Aabb
+{
+	Vector3f min;
+	Vector3f max;
+
+	static Aabb merge(const Aabb& a, const Aabb& b);
+	bool contains(const Aabb& b) const;
+	float area() const;			// surface area, the cost of a node in the tree
+};
+
+// the six planes of a view frustum, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+struct Frustum
+{
+	Vector4f planes[6];
+
+	enum class Result
+	{
+		Outside,
+		Intersect,
+		Inside,
+	};
+
+	// from projection * view, or projection * view * world for object-space boxes.
+	// orthographic : the projection has the last row 0, 0, 0, 1 instead of the perspective one of MathUtility
+	static Frustum fromMatrix(const Matrix4f& m, bool orthographic = false);
+	Result test(const Aabb& box) const;
+};
+
+// incrementally updated aabb tree: leaves hold fattened boxes so small moves cost nothing,
+// bigger ones reinsert the leaf and refit its ancestors, rotations keep the tree balanced.
+class DynamicBvh
+{
+public:
+	// returns the proxy of the new leaf
+	int insert(const Aabb& box, int userData);
+	void remove(int proxy);
+	// true if the leaf had to be reinserted
+	bool move(int proxy, const Aabb& box);
+
+	int getUserData(int proxy) const { return nodes[proxy].userData; };
+	const Aabb& getFatBox(int proxy) const { return nodes[proxy].box; };
+
+	// visits the tree from the root, skipping the children of the boxes enter() rejects
+	void traverse(const std::function<bool(const Aabb&)>& enter, const std::function<void(int userData)>& visit) const;
+	// userData of every leaf whose box is not outside the frustum, subtrees inside are taken without testing
+	void queryFrustum(const Frustum& frustum, std::vector<int>& result) const;
+
+	int getHeight() const { return root == -1 ? 0 : nodes[root].height; };
+	// around every leaf, only valid when the tree is not empty
+	const Aabb& getRootBox() const { return nodes[root].box; };
+
+	float margin = 0.1f;		// fattening, relative to the size of the box
+
+private:
+	struct Node
+	{
+		Aabb box;
+		int parent = -1;		// next free node when on the free list
+		int child1 = -1;
+		int child2 = -1;
+		int height = -1;		// 0 for a leaf, -1 when free
+		int userData = -1;
+
+		bool isLeaf() const { return child1 == -1; };
+	};
+
+	std::vector<Node> nodes;
+	int root = -1;
+	int freeList = -1;
+
+	int allocateNode();
+	void freeNode(int idx);
+	void insertLeaf(int leaf);
+	void removeLeaf(int leaf);
+	int balance(int idx);
+	void refit(int idx);
+	void collectLeaves(int idx, std::vector<int>& result) const;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "DynamicResolution.h"
+#include "Math.h"
+#include <cmath>
+#include <algorithm>
+
+DynamicResolution::DynamicResolution(int maxWidth, int maxHeight, float budgetMs, float minScale)
+	: maxWidth(maxWidth), maxHeight(maxHeight), budgetMs(budgetMs), minScale(minScale)
+{
+}
+
+bool DynamicResolution::update(float frameMs)
+{
+	avgMs = avgMs == 0.f ? frameMs : avgMs * 0.8f + frameMs * 0.2f;
+
+	// dead band between 80% and 100% of the budget so it does not oscillate
+	if (avgMs <= budgetMs && avgMs >= budgetMs * 0.8f)
+		return false;
+
+	// raster cost goes with the pixel count, so the side scales with the square root,
+	// at most 10% per frame: one slow frame should not halve the resolution
+	float step = MathUtility::clamp(std::sqrt(budgetMs / avgMs), 0.9f, 1.1f);
+	float newScale = MathUtility::clamp(scale * step, minScale, 1.f);
+
+	int oldWidth = getWidth();
+	int oldHeight = getHeight();
+	scale = newScale;
+	return oldWidth != getWidth() || oldHeight != getHeight();
+}
+
+// multiples of 8 so small changes of the scale do not reallocate every frame
+int DynamicResolution::getWidth() const
+{
+	if (scale >= 1.f)
+		return maxWidth;
+	return std::min(maxWidth, std::max(8, static_cast<int>(maxWidth * scale) / 8 * 8));
+}
+
+int DynamicResolution::getHeight() const
+{
+	if (scale >= 1.f)
+		return maxHeight;
+	return std::min(maxHeight, std::max(8, static_cast<int>(maxHeight * scale) / 8 * 8));
+}
\ No newline at end of file
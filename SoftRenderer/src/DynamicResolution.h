@@ -0,0 +1,30 @@
+#ifndef M_DYNAMIC_RESOLUTION_H
+#define M_DYNAMIC_RESOLUTION_H
+
+// picks the internal render resolution from the measured frame time,
+// shrinks it when frames go over the budget and grows it back when there is headroom.
+class DynamicResolution
+{
+public:
+	// minScale : lower bound of width and height relative to the output size
+	DynamicResolution(int maxWidth, int maxHeight, float budgetMs = 33.3f, float minScale = 0.5f);
+
+	// feed the time the last frame took, true if the resolution changed
+	bool update(float frameMs);
+
+	void setBudget(float ms) { budgetMs = ms; };
+	float getScale() const { return scale; };
+	int getWidth() const;
+	int getHeight() const;
+
+private:
+	int maxWidth;
+	int maxHeight;
+	float budgetMs;
+	float minScale;
+
+	float scale = 1.f;
+	float avgMs = 0.f;		// smoothed frame time, 0 until the first frame
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "FrameArena.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _DEBUG
+static thread_local size_t heapAllocations = 0;
+
+// counts, so a frame can check it did not touch the heap
+void* operator new(size_t size)
+{
+	++heapAllocations;
+	if (void* p = std::malloc(size == 0 ? 1 : size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+#endif
+
+FrameArena::FrameArena(size_t blockSize)
+{
+	addBlock(blockSize);
+}
+
+void FrameArena::addBlock(size_t minSize)
+{
+	if (!blocks.empty())
+		used += cur - blockBegin;
+
+	Block block{ std::make_unique<char[]>(minSize), minSize };
+	blockBegin = block.data.get();
+	cur = blockBegin;
+	end = blockBegin + minSize;
+	blocks.push_back(std::move(block));
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+	auto p = (reinterpret_cast<uintptr_t>(cur) + alignment - 1) & ~(alignment - 1);
+	if (p + size > reinterpret_cast<uintptr_t>(end))
+	{
+		// at least double, so a growing frame needs few blocks
+		addBlock(std::max(size + alignment, 2 * blocks.back().size));
+		p = (reinterpret_cast<uintptr_t>(cur) + alignment - 1) & ~(alignment - 1);
+	}
+	cur = reinterpret_cast<char*>(p + size);
+	return reinterpret_cast<void*>(p);
+}
+
+void FrameArena::reset()
+{
+	// one block that holds the whole frame next time
+	if (blocks.size() > 1)
+	{
+		size_t size = getCapacity();
+		blocks.clear();
+		used = 0;
+		addBlock(size);
+	}
+	cur = blockBegin;
+}
+
+size_t FrameArena::getCapacity() const
+{
+	size_t size = 0;
+	for (const auto& block : blocks)
+		size += block.size;
+	return size;
+}
+
+FrameArena& FrameArena::local()
+{
+	static thread_local FrameArena arena;
+	return arena;
+}
+
+size_t FrameArena::getHeapAllocations()
+{
+#ifdef _DEBUG
+	return heapAllocations;
+#else
+	return 0;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef M_FRAME_ARENA_H
+#define M_FRAME_ARENA_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// linear allocator for what only lives during a frame: an allocation bumps a pointer, nothing is freed
+// on its own, reset() at the end of the frame takes everything back at once. when a frame needs more
+// than the block, blocks are chained and merged into one big enough on the next reset, so after the
+// first frames the arena never goes to the heap again.
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t blockSize = 256 * 1024);
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+	// every allocation is gone, O(1) unless the frame overflowed the block
+	void reset();
+
+	size_t getUsed() const { return used + (cur - blockBegin); };
+	size_t getCapacity() const;
+
+	// the arena of the calling thread, each render thread has its own and resets it after its frames
+	static FrameArena& local();
+	// operator new calls made by the calling thread so far, counted in debug builds only
+	static size_t getHeapAllocations();
+
+private:
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	char* blockBegin = nullptr;
+	char* cur = nullptr;
+	char* end = nullptr;
+	size_t used = 0;				// in the blocks before the current one
+
+	void addBlock(size_t minSize);
+};
+
+// for std containers, deallocate does nothing: the memory comes back with the arena's reset
+template<typename T>
+class FrameAllocator
+{
+public:
+	using value_type = T;
+
+	FrameAllocator() : arena(&FrameArena::local()) {};
+	explicit FrameAllocator(FrameArena& arena) : arena(&arena) {};
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {};
+
+	T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); };
+	void deallocate(T*, size_t) {};
+
+	template<typename U>
+	bool operator==(const FrameAllocator<U>& other) const { return arena == other.arena; };
+	template<typename U>
+	bool operator!=(const FrameAllocator<U>& other) const { return arena != other.arena; };
+
+	FrameArena* arena;
+};
+
+// scratch array on the calling thread's arena, must not outlive the frame
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "FramePipeline.h"
+#include <algorithm>
+
+namespace
+{
+	// lerp the four 8 bit channels of two packed pixels at once, f in [0, 256]
+	inline Uint32 lerpPixel(Uint32 a, Uint32 b, Uint32 f)
+	{
+		Uint32 rb = (((a & 0x00ff00ff) * (256 - f) + (b & 0x00ff00ff) * f) >> 8) & 0x00ff00ff;
+		Uint32 ag = (((a >> 8) & 0x00ff00ff) * (256 - f) + ((b >> 8) & 0x00ff00ff) * f) & 0xff00ff00;
+		return rb | ag;
+	}
+
+	// stretch the srcW x srcH top-left part of src over the whole dst
+	void upscale(SDL_Surface* src, int srcW, int srcH, SDL_Surface* dst)
+	{
+		if (src->format->BytesPerPixel != 4 || src->format->format != dst->format->format)
+		{
+			SDL_Rect rect = { 0, 0, srcW, srcH };
+			SDL_BlitScaled(src, &rect, dst, NULL);
+			return;
+		}
+
+		// source coordinate of every destination column in 24.8 fixed point, sampled at pixel centers
+		std::vector<int> xs(dst->w);
+		for (int x = 0; x < dst->w; ++x)
+		{
+			float sx = (x + 0.5f) * srcW / dst->w - 0.5f;
+			xs[x] = static_cast<int>(MathUtility::clamp(sx, 0.f, srcW - 1.f) * 256);
+		}
+
+		if (SDL_MUSTLOCK(dst))
+			SDL_LockSurface(dst);
+
+		for (int y = 0; y < dst->h; ++y)
+		{
+			float sy = MathUtility::clamp((y + 0.5f) * srcH / dst->h - 0.5f, 0.f, srcH - 1.f);
+			int y0 = static_cast<int>(sy);
+			int y1 = std::min(y0 + 1, srcH - 1);
+			Uint32 fy = static_cast<Uint32>((sy - y0) * 256);
+
+			auto row0 = reinterpret_cast<const Uint32*>(static_cast<Uint8*>(src->pixels) + y0 * src->pitch);
+			auto row1 = reinterpret_cast<const Uint32*>(static_cast<Uint8*>(src->pixels) + y1 * src->pitch);
+			auto out = reinterpret_cast<Uint32*>(static_cast<Uint8*>(dst->pixels) + y * dst->pitch);
+
+			for (int x = 0; x < dst->w; ++x)
+			{
+				int x0 = xs[x] >> 8;
+				int x1 = std::min(x0 + 1, srcW - 1);
+				Uint32 fx = xs[x] & 0xff;
+				out[x] = lerpPixel(lerpPixel(row0[x0], row0[x1], fx), lerpPixel(row1[x0], row1[x1], fx), fy);
+			}
+		}
+
+		if (SDL_MUSTLOCK(dst))
+			SDL_UnlockSurface(dst);
+	}
+}
+
+FramePipeline::FramePipeline(SDL_Surface* screen, int depth)
+{
+	depth = std::max(depth, 1);
+	for (int i = 0; i < depth; ++i)
+	{
+		Target target;
+		target.texture = Texture(screen);
+		target.width = target.texture.width;
+		target.height = target.texture.height;
+		target.index = i;
+		targets.push_back(target);
+		freeTargets.push_back(i);
+	}
+}
+
+FramePipeline::~FramePipeline()
+{
+	stop();
+}
+
+void FramePipeline::start(std::function<void(Target& target)> renderFrame)
+{
+	stop();
+	this->renderFrame = renderFrame;
+	running = true;
+	worker = std::thread(&FramePipeline::run, this);
+}
+
+void FramePipeline::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		running = false;
+	}
+	cv.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+void FramePipeline::run()
+{
+	while (true)
+	{
+		int idx = -1;
+		{
+			// bounded: wait until a presented frame hands its target back
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this] { return !running || !freeTargets.empty(); });
+			if (!running)
+				return;
+			idx = freeTargets.front();
+			freeTargets.pop_front();
+		}
+
+		renderFrame(targets[idx]);
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			readyTargets.push_back(idx);
+		}
+		cv.notify_all();
+	}
+}
+
+bool FramePipeline::present(SDL_Window* window, SDL_Surface* screen, bool wait)
+{
+	int idx = -1;
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		if (wait)
+			cv.wait(lock, [this] { return !running || !readyTargets.empty(); });
+		if (readyTargets.empty())
+			return false;
+		idx = readyTargets.front();
+		readyTargets.pop_front();
+	}
+
+	auto& target = targets[idx];
+	if (target.width == screen->w && target.height == screen->h)
+		SDL_BlitSurface(target.texture.getRawSurface(), NULL, screen, NULL);
+	else
+		upscale(target.texture.getRawSurface(), target.width, target.height, screen);
+
+	// the target is free again once copied, the worker can start on it while the window updates
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		freeTargets.push_back(idx);
+	}
+	cv.notify_all();
+
+	SDL_UpdateWindowSurface(window);
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef M_FRAME_PIPELINE_H
+#define M_FRAME_PIPELINE_H
+
+#include <SDL.h>
+#include "Texture.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+// renders frames on a worker thread while the main thread presents the previous ones.
+// depth is the number of frames in flight: 1 keeps the latency lowest, every extra frame lets the
+// renderer run ahead of the presentation for throughput at the cost of one frame of latency.
+class FramePipeline
+{
+public:
+	struct Target
+	{
+		Texture texture;
+		// the top-left part of texture that was rendered, upscaled to the window at present
+		int width = 0;
+		int height = 0;
+		// the targets are reused in turn, a target keeps the last frame drawn into it
+		int index = 0;
+	};
+
+	FramePipeline(SDL_Surface* screen, int depth = 2);
+	~FramePipeline();
+
+	// renderFrame is called on the worker thread with the target of the next frame
+	void start(std::function<void(Target& target)> renderFrame);
+	void stop();
+
+	// main thread: blit the oldest finished frame to the window, false if no frame was ready.
+	// frames rendered below the window size are upscaled bilinearly
+	bool present(SDL_Window* window, SDL_Surface* screen, bool wait = true);
+
+private:
+	void run();
+
+	std::vector<Target> targets;
+	std::deque<int> freeTargets;
+	std::deque<int> readyTargets;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::thread worker;
+	bool running = false;
+
+	std::function<void(Target& target)> renderFrame;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef M_HDR_IMAGE_H
+#define M_HDR_IMAGE_H
+
+#include <vector>
+#include <algorithm>
+
+// float color, one plane per channel so a pass runs along a row without gathering the channels.
+// rows from the bottom like the renderer, 1.0 is the brightest color of an 8-bit target
+struct HdrImage
+{
+	int width = 0;
+	int height = 0;
+	std::vector<float> planes[3];		// r, g, b
+
+	// keeps the storage when it shrinks
+	void resize(int w, int h)
+	{
+		width = w;
+		height = h;
+		for (auto& plane : planes)
+			plane.resize(static_cast<size_t>(w) * h);
+	};
+
+	float* row(int channel, int y) { return &planes[channel][static_cast<size_t>(y) * width]; };
+	const float* row(int channel, int y) const { return &planes[channel][static_cast<size_t>(y) * width]; };
+
+	void fill(float r, float g, float b, int x0, int y0, int x1, int y1)
+	{
+		float col[] = { r, g, b };
+		for (int c = 0; c < 3; ++c)
+		{
+			for (int y = y0; y <= y1; ++y)
+				std::fill(row(c, y) + x0, row(c, y) + x1 + 1, col[c]);
+		}
+	};
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+#include "Light.h"
+
+float Light::attenuation(float r_2) const
+{
+	float t = r_2 / (radius * radius);
+	float window = MathUtility::clamp(1.f - t * t, 0.f, 1.f);
+	return window * window / r_2;
+}
+
+float Light::defaultRadius(const Vector3f& it)
+{
+	float maxI = std::max(it.x, std::max(it.y, it.z));
+	return std::sqrt(std::max(maxI, 0.f) * 255.f);
+}
\ No newline at end of file
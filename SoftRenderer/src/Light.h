@@ -10,9 +10,20 @@ public:
 	// just put it in view space simply.
 	Vector3f position = {0, 0, 0};
 	Vector3f intensity = {500, 500, 500};
+	// the light has no effect beyond radius, used to cull it from screen tiles.
+	float radius = defaultRadius(Vector3f{ 500, 500, 500 });
+	// index in FragmentShaderParams::shadowMaps, -1 casts no shadow
+	int shadowMapIdx = -1;
 
 	Light(){}
-	Light(Vector3f pos, Vector3f it) : position(pos), intensity(it){}
+	Light(Vector3f pos, Vector3f it) : position(pos), intensity(it), radius(defaultRadius(it)) {}
+	Light(Vector3f pos, Vector3f it, float r) : position(pos), intensity(it), radius(r) {}
+
+	// smooth falloff to zero at radius, r_2 is the squared distance to the light
+	float attenuation(float r_2) const;
+
+	// the distance where I / r^2 drops under one 8-bit color step
+	static float defaultRadius(const Vector3f& it);
 };
 
 #endif
\ No newline at end of file
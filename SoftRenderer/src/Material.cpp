@@ -0,0 +1,29 @@
+#include "Material.h"
+#include "fragmentShader.h"
+
+const float Material::AMBIENT_INTENSITY = 10.f;
+
+Material::Material(const Vector3f& Ka, const Vector3f& Kd, const Vector3f& Ks, float Ns, int diffuseTextureIdx, int specularTextureIdx)
+{
+	uniforms.features = Untextured;
+	if (diffuseTextureIdx != -1)
+		uniforms.features |= DiffuseMap;
+	if (specularTextureIdx != -1)
+		uniforms.features |= SpecularMap;
+	uniforms.shader = getMaterialShader(uniforms.features);
+	uniforms.specializes = fragmentShader;
+
+	uniforms.ambient = Ka.mulByVector(Vector3f{ AMBIENT_INTENSITY, AMBIENT_INTENSITY, AMBIENT_INTENSITY });
+	uniforms.Kd = Kd;
+	uniforms.Ks = Ks;
+	uniforms.Ns = Ns;
+	uniforms.diffuseTextureIdx = diffuseTextureIdx;
+	uniforms.specularTextureIdx = specularTextureIdx;
+}
+
+void Material::bind(DrawParams& dp) const
+{
+	dp.fsParams.material = &uniforms;
+	// untextured materials are smooth enough to be shaded coarsely where the screen is flat
+	dp.shadingRate = (uniforms.features & DiffuseMap) ? ShadingRate::Rate1x1 : ShadingRate::Rate4x4;
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef M_MATERIAL_H
+#define M_MATERIAL_H
+
+#include "Math.h"
+#include "Renderer.h"
+
+// a plain function, the renderer calls it without going through a std::function
+using MaterialShader = Vector4f (*)(FragmentShaderParams&);
+
+// what the fragment shader of a material reads, computed once when the material is made
+struct MaterialUniforms
+{
+	MaterialShader shader = nullptr;		// the variant for the features
+	MaterialShader specializes = nullptr;	// the shader it stands in for, only when that one is bound
+	int features = 0;
+	Vector3f ambient;			// Ka lit by the ambient light
+	Vector3f Kd;
+	Vector3f Ks;
+	float Ns = 0.f;
+	int diffuseTextureIdx = -1;
+	int specularTextureIdx = -1;
+};
+
+// phong constants and the textures replacing some of them. the maps it has pick, once, a fragment shader
+// compiled for exactly them, so no fragment asks which maps there are
+class Material
+{
+public:
+	enum Feature
+	{
+		Untextured = 0,
+		DiffuseMap = 1 << 0,
+		SpecularMap = 1 << 1,
+		FEATURE_COUNT = 1 << 2,		// of the combinations
+	};
+
+	Material() : Material(Vector3f{ 0, 0, 0 }, Vector3f{ 0, 0, 0 }, Vector3f{ 0, 0, 0 }, 0.f) {};
+	// textures : indices into FragmentShaderParams::textureVec, -1 for none
+	Material(const Vector3f& Ka, const Vector3f& Kd, const Vector3f& Ks, float Ns, int diffuseTextureIdx = -1, int specularTextureIdx = -1);
+
+	int getFeatures() const { return uniforms.features; };
+	const MaterialUniforms& getUniforms() const { return uniforms; };
+
+	// the draw reads the uniforms of the material in place, it must not move until the draw is done
+	void bind(DrawParams& dp) const;
+
+	// the light the ambient color is lit by
+	static const float AMBIENT_INTENSITY;
+
+private:
+	MaterialUniforms uniforms;
+};
+
+#endif
\ No newline at end of file
@@ -286,19 +286,16 @@ Matrix3f Matrix3f::inverse() const
 
 Matrix4f Matrix4f::adjugate() const
 {
-	std::vector<float> nums;
+	Matrix4f res;
 	for (int i = 0; i < 4; ++i)
 	{
 		for (int j = 0; j < 4; ++j)
 		{
 			auto Aij = getMij(i, j).determinant() * ((i + j) % 2 ? -1 : 1);
-			nums.push_back(Aij);
+			res.num[i * 4 + j] = Aij;
 		}
 	}
 
-	Matrix4f res = { 0 };
-	std::copy(nums.begin(), nums.end(), std::begin(res.num));
-
 	return res.transpose();
 }
 
@@ -401,19 +398,17 @@ Vector4f operator/(const Vector4f& v, float n)
 
 Matrix3f Matrix4f::getMij(int i, int j) const
 {
-	std::vector<float> nums;
+	Matrix3f res;
+	int n = 0;
 	for (int x = 0; x < 4; ++x)
 	{
 		for (int y = 0; y < 4; ++y)
 		{
 			if (x != i && y != j)
-				nums.push_back(num[x * 4 + y]);
+				res.num[n++] = num[x * 4 + y];
 		}
 	}
 
-	Matrix3f res = {0};
-	std::copy(nums.begin(), nums.end(), std::begin(res.num));
-
 	return res;
 }
 
@@ -494,6 +489,31 @@ Matrix4f MathUtility::getPerspctiveMatrix(float fov, float aspectRatio, float zN
 	};
 }
 
+Matrix4f MathUtility::lookAt(const Vector3f& eye, const Vector3f& target, const Vector3f& up)
+{
+	auto fwd = (target - eye).normalize();
+	auto right = fwd.crossProduct(up);
+	// up is parallel to the view direction, pick another one
+	if (right.squreLen() < 1e-8f)
+		right = fwd.crossProduct(Vector3f{ 0, 0, 1 });
+	right = right.normalize();
+	auto newUp = right.crossProduct(fwd);
+
+	auto rotateM = Matrix4f{
+		right.x, right.y, right.z, 0,
+		newUp.x, newUp.y, newUp.z, 0,
+		-fwd.x, -fwd.y, -fwd.z, 0,
+		0, 0, 0, 1
+	};
+	auto transM = Matrix4f{
+		1, 0, 0, -eye.x,
+		0, 1, 0, -eye.y,
+		0, 0, 1, -eye.z,
+		0, 0, 0, 1
+	};
+	return rotateM * transM;
+}
+
 Matrix4f MathUtility::rotateX(const float angle)
 {
 	auto radians = angle * PI / 180.f;
@@ -127,6 +127,8 @@ public:
 	}
 
 	static Matrix4f getPerspctiveMatrix(float fov, float aspectRatio, float zNear, float zFar);
+	// view matrix looking from eye to target, faces -z like Camera
+	static Matrix4f lookAt(const Vector3f& eye, const Vector3f& target, const Vector3f& up);
 
 	// 
 	static Matrix4f rotateX(const float angle);
@@ -0,0 +1,332 @@
+#include "MeshOptimizer.h"
+#include "DirtyRegion.h"
+#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+namespace
+{
+	// forsyth's vertex score: a vertex used by the last triangles, or with few triangles left, pulls its triangles first
+	float vertexScore(int cachePos, int remaining)
+	{
+		if (remaining == 0)
+			return -1.f;
+		float score = 0.f;
+		if (cachePos >= 0)
+			score = cachePos < 3 ? 0.75f : std::pow(1.f - (cachePos - 3) / static_cast<float>(MeshOptimizer::CACHE_SIZE - 3), 1.5f);
+		return score + 2.f / std::sqrt(static_cast<float>(remaining));
+	}
+}
+
+void MeshOptimizer::optimize(std::vector<Vector3f>& positions,
+	std::vector<Vector3f>& normals,
+	std::vector<Vector2f>& uvs,
+	std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+	std::vector<Vector3i>& indices,
+	Stats* before, Stats* after)
+{
+	if (before != nullptr)
+		*before = getStats(static_cast<int>(positions.size()), indices);
+
+	weld(positions, normals, uvs, boneWeight, indices);
+	optimizeTriangles(positions, indices);
+	remapVertices(positions, normals, uvs, boneWeight, indices);
+
+	if (after != nullptr)
+		*after = getStats(static_cast<int>(positions.size()), indices);
+}
+
+void MeshOptimizer::optimizeTriangles(const std::vector<Vector3f>& positions, std::vector<Vector3i>& indices)
+{
+	orderForCache(static_cast<int>(positions.size()), indices);
+	orderForOverdraw(positions, indices);
+}
+
+MeshOptimizer::Stats MeshOptimizer::getStats(int vertexCount, const std::vector<Vector3i>& indices)
+{
+	Stats stats;
+	stats.vertexCount = vertexCount;
+	stats.triangleCount = static_cast<int>(indices.size());
+
+	// a fifo, a vertex still in it costs nothing
+	std::vector<int> stamp(vertexCount, -CACHE_SIZE - 1);
+	int misses = 0;
+	for (const auto& tri : indices)
+	{
+		for (int v : { tri.x, tri.y, tri.z })
+		{
+			if (misses - stamp[v] >= CACHE_SIZE)
+				stamp[v] = ++misses;
+		}
+	}
+	stats.acmr = indices.empty() ? 0.f : misses / static_cast<float>(indices.size());
+	return stats;
+}
+
+// every vertex is pointed at the first one with the same attributes, the triangles that lose their area go
+void MeshOptimizer::weld(const std::vector<Vector3f>& positions,
+	const std::vector<Vector3f>& normals,
+	const std::vector<Vector2f>& uvs,
+	const std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+	std::vector<Vector3i>& indices)
+{
+	int vertexCount = static_cast<int>(positions.size());
+	int normalCount = static_cast<int>(normals.size());
+	int uvCount = static_cast<int>(uvs.size());
+	int weightCount = static_cast<int>(boneWeight.size());
+	auto hashVertex = [&](int v) {
+		uint64_t h = DirtyRegion::hash(&positions[v], sizeof(Vector3f));
+		if (v < normalCount)
+			h = DirtyRegion::hash(&normals[v], sizeof(Vector3f), h);
+		if (v < uvCount)
+			h = DirtyRegion::hash(&uvs[v], sizeof(Vector2f), h);
+		if (v < weightCount && !boneWeight[v].empty())
+			h = DirtyRegion::hash(boneWeight[v].data(), boneWeight[v].size() * sizeof(boneWeight[v][0]), h);
+		return h;
+	};
+	auto same = [&](int a, int b) {
+		if (std::memcmp(&positions[a], &positions[b], sizeof(Vector3f)) != 0)
+			return false;
+		if (a < normalCount && std::memcmp(&normals[a], &normals[b], sizeof(Vector3f)) != 0)
+			return false;
+		if (a < uvCount && std::memcmp(&uvs[a], &uvs[b], sizeof(Vector2f)) != 0)
+			return false;
+		return a >= weightCount || boneWeight[a] == boneWeight[b];
+	};
+
+	// vertices with the same hash are chained from the last one seen
+	std::unordered_map<uint64_t, int> lastWithHash;
+	lastWithHash.reserve(vertexCount);
+	std::vector<int> prevWithHash(vertexCount, -1);
+	std::vector<int> remap(vertexCount);
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		auto h = hashVertex(v);
+		auto it = lastWithHash.find(h);
+		int match = -1;
+		for (int c = it == lastWithHash.end() ? -1 : it->second; c != -1 && match == -1; c = prevWithHash[c])
+		{
+			if (same(c, v))
+				match = c;
+		}
+		if (match != -1)
+		{
+			remap[v] = remap[match];
+			continue;
+		}
+		remap[v] = v;
+		prevWithHash[v] = it == lastWithHash.end() ? -1 : it->second;
+		lastWithHash[h] = v;
+	}
+
+	size_t count = 0;
+	for (const auto& tri : indices)
+	{
+		Vector3i welded{ remap[tri.x], remap[tri.y], remap[tri.z] };
+		if (welded.x != welded.y && welded.y != welded.z && welded.z != welded.x)
+			indices[count++] = welded;
+	}
+	indices.resize(count);
+}
+
+// greedy, the next triangle is the best scoring one among those of the vertices in the cache
+void MeshOptimizer::orderForCache(int vertexCount, std::vector<Vector3i>& indices)
+{
+	int triCount = static_cast<int>(indices.size());
+	if (triCount == 0)
+		return;
+
+	// the triangles of vertex v not emitted yet are adjacency[offsets[v], offsets[v] + remaining[v])
+	std::vector<int> offsets(vertexCount + 1, 0);
+	for (const auto& tri : indices)
+	{
+		++offsets[tri.x + 1];
+		++offsets[tri.y + 1];
+		++offsets[tri.z + 1];
+	}
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<int> remaining(vertexCount, 0);
+	std::vector<int> adjacency(offsets[vertexCount]);
+	for (int t = 0; t < triCount; ++t)
+	{
+		for (int v : { indices[t].x, indices[t].y, indices[t].z })
+			adjacency[offsets[v] + remaining[v]++] = t;
+	}
+
+	std::vector<int> cachePos(vertexCount, -1);
+	std::vector<float> scores(vertexCount);
+	for (int v = 0; v < vertexCount; ++v)
+		scores[v] = vertexScore(-1, remaining[v]);
+	std::vector<float> triScores(triCount);
+	std::vector<bool> emitted(triCount, false);
+	int best = 0;
+	for (int t = 0; t < triCount; ++t)
+	{
+		triScores[t] = scores[indices[t].x] + scores[indices[t].y] + scores[indices[t].z];
+		if (triScores[t] > triScores[best])
+			best = t;
+	}
+
+	int cache[CACHE_SIZE + 3];
+	int cacheCount = 0;
+	int scan = 0;
+	std::vector<Vector3i> out;
+	out.reserve(triCount);
+	while (static_cast<int>(out.size()) < triCount)
+	{
+		// nothing in the cache has triangles left, start again from the first one in the input order
+		if (best == -1)
+		{
+			while (emitted[scan])
+				++scan;
+			best = scan;
+		}
+
+		const auto tri = indices[best];
+		int verts[] = { tri.x, tri.y, tri.z };
+		out.push_back(tri);
+		emitted[best] = true;
+		for (int v : verts)
+		{
+			int* adj = &adjacency[offsets[v]];
+			int* last = adj + --remaining[v];
+			*std::find(adj, last + 1, best) = *last;
+		}
+
+		// the triangle's vertices go in front, what falls off the end leaves the cache
+		int next[CACHE_SIZE + 3];
+		int nextCount = 0;
+		for (int v : verts)
+			next[nextCount++] = v;
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			if (cache[i] != verts[0] && cache[i] != verts[1] && cache[i] != verts[2])
+				next[nextCount++] = cache[i];
+		}
+
+		best = -1;
+		float bestScore = -1.f;
+		for (int i = 0; i < nextCount; ++i)
+		{
+			int v = next[i];
+			cachePos[v] = i < CACHE_SIZE ? i : -1;
+			float score = vertexScore(cachePos[v], remaining[v]);
+			float delta = score - scores[v];
+			scores[v] = score;
+			for (int k = offsets[v]; k < offsets[v] + remaining[v]; ++k)
+				triScores[adjacency[k]] += delta;
+		}
+		cacheCount = std::min(nextCount, CACHE_SIZE);
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			int v = next[i];
+			cache[i] = v;
+			for (int k = offsets[v]; k < offsets[v] + remaining[v]; ++k)
+			{
+				if (triScores[adjacency[k]] > bestScore)
+				{
+					bestScore = triScores[adjacency[k]];
+					best = adjacency[k];
+				}
+			}
+		}
+	}
+	indices.swap(out);
+}
+
+// runs of CLUSTER_SIZE triangles in the cache order, those facing out from the center of the mesh and
+// farthest along their facing first: from most views they are in front of the rest
+void MeshOptimizer::orderForOverdraw(const std::vector<Vector3f>& positions, std::vector<Vector3i>& indices)
+{
+	int triCount = static_cast<int>(indices.size());
+	int clusterCount = (triCount + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	if (clusterCount <= 1)
+		return;
+
+	// area weighted
+	Vector3f meshCenter{ 0.f, 0.f, 0.f };
+	float meshArea = 0.f;
+	std::vector<Vector3f> centers(clusterCount, Vector3f{ 0.f, 0.f, 0.f });
+	std::vector<Vector3f> normals(clusterCount, Vector3f{ 0.f, 0.f, 0.f });
+	std::vector<float> areas(clusterCount, 0.f);
+	for (int t = 0; t < triCount; ++t)
+	{
+		const auto& a = positions[indices[t].x];
+		const auto& b = positions[indices[t].y];
+		const auto& c = positions[indices[t].z];
+		auto n = (b - a).crossProduct(c - a);
+		float area = n.length();
+		auto center = (area / 3.f) * (a + b + c);
+		int cluster = t / CLUSTER_SIZE;
+		centers[cluster] = centers[cluster] + center;
+		normals[cluster] = normals[cluster] + n;
+		areas[cluster] += area;
+		meshCenter = meshCenter + center;
+		meshArea += area;
+	}
+	if (meshArea <= 0.f)
+		return;
+	meshCenter = (1.f / meshArea) * meshCenter;
+
+	std::vector<float> keys(clusterCount, 0.f);
+	for (int i = 0; i < clusterCount; ++i)
+	{
+		float len = normals[i].length();
+		if (areas[i] > 0.f && len > 0.f)
+			keys[i] = ((1.f / areas[i]) * centers[i] - meshCenter).dotProduct((1.f / len) * normals[i]);
+	}
+
+	std::vector<int> order(clusterCount);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return keys[a] > keys[b]; });
+
+	std::vector<Vector3i> out;
+	out.reserve(triCount);
+	for (int cluster : order)
+	{
+		int end = std::min(triCount, (cluster + 1) * CLUSTER_SIZE);
+		out.insert(out.end(), indices.begin() + cluster * CLUSTER_SIZE, indices.begin() + end);
+	}
+	indices.swap(out);
+}
+
+// numbered in the order of first use, the vertices no triangle uses are dropped
+void MeshOptimizer::remapVertices(std::vector<Vector3f>& positions,
+	std::vector<Vector3f>& normals,
+	std::vector<Vector2f>& uvs,
+	std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+	std::vector<Vector3i>& indices)
+{
+	std::vector<int> remap(positions.size(), -1);
+	std::vector<int> order;
+	order.reserve(positions.size());
+	for (auto& tri : indices)
+	{
+		for (int* v : { &tri.x, &tri.y, &tri.z })
+		{
+			if (remap[*v] == -1)
+			{
+				remap[*v] = static_cast<int>(order.size());
+				order.push_back(*v);
+			}
+			*v = remap[*v];
+		}
+	}
+
+	auto gather = [&](auto& attribute) {
+		if (attribute.size() < positions.size())
+			return;
+		std::remove_reference_t<decltype(attribute)> out;
+		out.reserve(order.size());
+		for (int v : order)
+			out.push_back(std::move(attribute[v]));
+		attribute.swap(out);
+	};
+	gather(normals);
+	gather(uvs);
+	gather(boneWeight);
+	gather(positions);
+}
\ No newline at end of file
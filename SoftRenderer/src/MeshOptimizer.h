@@ -0,0 +1,53 @@
+#ifndef M_MESH_OPTIMIZER_H
+#define M_MESH_OPTIMIZER_H
+
+#include "Math.h"
+#include <vector>
+#include <utility>
+
+// load-time reordering of a mesh, independent of what the importer did: identical vertices are welded,
+// triangles are ordered so consecutive ones share vertices, runs of them are ordered so the outer
+// surfaces come first and hide what is behind them from the depth test, and the vertices are stored
+// in the order the triangles first use them.
+class MeshOptimizer
+{
+public:
+	static const int CACHE_SIZE = 16;			// fifo of transformed vertices the stats are measured with
+	static const int CLUSTER_SIZE = 128;		// triangles moved together by the overdraw ordering
+
+	struct Stats
+	{
+		int vertexCount = 0;
+		int triangleCount = 0;
+		float acmr = 0.f;		// vertices missing the fifo per triangle, 0.5 at best, 3 at worst
+	};
+
+	// rewrites every array, boneWeight may be empty
+	static void optimize(std::vector<Vector3f>& positions,
+		std::vector<Vector3f>& normals,
+		std::vector<Vector2f>& uvs,
+		std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+		std::vector<Vector3i>& indices,
+		Stats* before = nullptr, Stats* after = nullptr);
+
+	// the triangle orders only, for more index lists over an optimized vertex buffer (the lods)
+	static void optimizeTriangles(const std::vector<Vector3f>& positions, std::vector<Vector3i>& indices);
+
+	static Stats getStats(int vertexCount, const std::vector<Vector3i>& indices);
+
+private:
+	static void weld(const std::vector<Vector3f>& positions,
+		const std::vector<Vector3f>& normals,
+		const std::vector<Vector2f>& uvs,
+		const std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+		std::vector<Vector3i>& indices);
+	static void orderForCache(int vertexCount, std::vector<Vector3i>& indices);
+	static void orderForOverdraw(const std::vector<Vector3f>& positions, std::vector<Vector3i>& indices);
+	static void remapVertices(std::vector<Vector3f>& positions,
+		std::vector<Vector3f>& normals,
+		std::vector<Vector2f>& uvs,
+		std::vector<std::vector<std::pair<int, float>>>& boneWeight,
+		std::vector<Vector3i>& indices);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,314 @@
+#include "MeshSimplifier.h"
+#include <queue>
+#include <numeric>
+
+namespace
+{
+	// symmetric 4x4 matrix of the plane equation, sum of squared distances to the planes
+	struct Quadric
+	{
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+
+		void addPlane(double a, double b, double c, double d)
+		{
+			a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+			b2 += b * b; bc += b * c; bd += b * d;
+			c2 += c * c; cd += c * d;
+			d2 += d * d;
+		}
+
+		void add(const Quadric& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+		}
+
+		double eval(const Vector3f& v) const
+		{
+			double x = v.x, y = v.y, z = v.z;
+			return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+				+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+				+ c2 * z * z + 2 * cd * z
+				+ d2;
+		}
+	};
+
+	struct Collapse
+	{
+		double cost;
+		int from;
+		int to;
+		int fromStamp;
+		int toStamp;
+
+		bool operator>(const Collapse& rhs) const { return cost > rhs.cost; }
+	};
+
+	Vector3f triNormal(const Vector3f& a, const Vector3f& b, const Vector3f& c)
+	{
+		return (b - a).crossProduct(c - a);
+	}
+}
+
+MeshSimplifier::MeshSimplifier(const std::vector<Vector3f>& positions,
+	const std::vector<Vector3f>& normals,
+	const std::vector<Vector2f>& uvs,
+	const std::vector<std::vector<std::pair<int, float>>>& boneWeight)
+	: positions(positions), remap(positions.size()), locked(positions.size(), false)
+{
+	std::iota(remap.begin(), remap.end(), 0);
+
+	// group the vertices by position
+	std::vector<int> order(positions.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](int a, int b) {
+		const auto& pa = positions[a];
+		const auto& pb = positions[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		return pa.z < pb.z;
+	});
+
+	size_t begin = 0;
+	while (begin < order.size())
+	{
+		size_t end = begin + 1;
+		const auto& p = positions[order[begin]];
+		while (end < order.size() && positions[order[end]].x == p.x && positions[order[end]].y == p.y && positions[order[end]].z == p.z)
+			++end;
+
+		int wedgeCount = 0;
+		for (size_t i = begin; i < end; ++i)
+		{
+			int v = order[i];
+			for (size_t j = begin; j < i; ++j)
+			{
+				int w = order[j];
+				if (remap[w] == w && sameAttributes(v, w, normals, uvs, boneWeight))
+				{
+					remap[v] = w;
+					break;
+				}
+			}
+			if (remap[v] == v)
+				++wedgeCount;
+		}
+
+		if (wedgeCount > 1)
+		{
+			for (size_t i = begin; i < end; ++i)
+				locked[order[i]] = true;
+		}
+		begin = end;
+	}
+}
+
+bool MeshSimplifier::sameAttributes(int a, int b,
+	const std::vector<Vector3f>& normals,
+	const std::vector<Vector2f>& uvs,
+	const std::vector<std::vector<std::pair<int, float>>>& boneWeight) const
+{
+	if (!normals.empty())
+	{
+		const auto& na = normals[a];
+		const auto& nb = normals[b];
+		if (na.x != nb.x || na.y != nb.y || na.z != nb.z)
+			return false;
+	}
+
+	if (!uvs.empty() && (uvs[a].x != uvs[b].x || uvs[a].y != uvs[b].y))
+		return false;
+
+	if (!boneWeight.empty())
+	{
+		auto wa = boneWeight[a];
+		auto wb = boneWeight[b];
+		std::sort(wa.begin(), wa.end());
+		std::sort(wb.begin(), wb.end());
+		if (wa != wb)
+			return false;
+	}
+
+	return true;
+}
+
+std::vector<Vector3i> MeshSimplifier::simplify(const std::vector<Vector3i>& indices, size_t targetTriCount, float maxError, float& error) const
+{
+	error = 0.f;
+
+	std::vector<Vector3i> tris;
+	tris.reserve(indices.size());
+	for (const auto& t : indices)
+	{
+		Vector3i r = { remap[t.x], remap[t.y], remap[t.z] };
+		if (r.x != r.y && r.y != r.z && r.z != r.x)
+			tris.push_back(r);
+	}
+
+	auto vertexCount = positions.size();
+	std::vector<Quadric> quadrics(vertexCount);
+	std::vector<std::vector<int>> vertexTris(vertexCount);
+	std::vector<bool> triAlive(tris.size(), true);
+	std::vector<bool> vertexLocked = locked;
+
+	std::vector<std::pair<int, int>> edges;
+	edges.reserve(tris.size() * 3);
+
+	for (int i = 0; i < static_cast<int>(tris.size()); ++i)
+	{
+		int v[] = { tris[i].x, tris[i].y, tris[i].z };
+		auto n = triNormal(positions[v[0]], positions[v[1]], positions[v[2]]);
+		auto len = n.length();
+		if (len > 1e-12f)
+		{
+			n = n / len;
+			Quadric q;
+			q.addPlane(n.x, n.y, n.z, -n.dotProduct(positions[v[0]]));
+			for (int k = 0; k < 3; ++k)
+				quadrics[v[k]].add(q);
+		}
+
+		for (int k = 0; k < 3; ++k)
+		{
+			vertexTris[v[k]].push_back(i);
+			edges.push_back({ std::min(v[k], v[(k + 1) % 3]), std::max(v[k], v[(k + 1) % 3]) });
+		}
+	}
+
+	// an edge used by only one triangle is on the border, lock it to keep the silhouette of open meshes
+	std::sort(edges.begin(), edges.end());
+	std::vector<std::pair<int, int>> uniqueEdges;
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i])
+			++j;
+		if (j - i == 1)
+		{
+			vertexLocked[edges[i].first] = true;
+			vertexLocked[edges[i].second] = true;
+		}
+		uniqueEdges.push_back(edges[i]);
+		i = j;
+	}
+
+	std::vector<int> stamps(vertexCount, 0);
+	std::vector<bool> vertexAlive(vertexCount, true);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+	auto pushCollapse = [&](int from, int to) {
+		if (vertexLocked[from])
+			return;
+		Quadric q = quadrics[from];
+		q.add(quadrics[to]);
+		heap.push({ q.eval(positions[to]), from, to, stamps[from], stamps[to] });
+	};
+
+	for (const auto& e : uniqueEdges)
+	{
+		pushCollapse(e.first, e.second);
+		pushCollapse(e.second, e.first);
+	}
+
+	size_t liveTris = tris.size();
+	double maxCost = 0.0;
+	double costLimit = static_cast<double>(maxError) * maxError;
+	std::vector<int> neighbors;
+
+	while (liveTris > targetTriCount && !heap.empty())
+	{
+		auto c = heap.top();
+		heap.pop();
+
+		if (!vertexAlive[c.from] || !vertexAlive[c.to] || stamps[c.from] != c.fromStamp || stamps[c.to] != c.toStamp)
+			continue;
+
+		if (c.cost > costLimit)
+			break;
+
+		// reject the collapse if it flips any of the remaining triangles
+		bool flipped = false;
+		for (int t : vertexTris[c.from])
+		{
+			if (!triAlive[t])
+				continue;
+			int v[] = { tris[t].x, tris[t].y, tris[t].z };
+			if (v[0] == c.to || v[1] == c.to || v[2] == c.to)
+				continue;
+
+			auto before = triNormal(positions[v[0]], positions[v[1]], positions[v[2]]);
+			for (auto& k : v)
+			{
+				if (k == c.from)
+					k = c.to;
+			}
+			auto after = triNormal(positions[v[0]], positions[v[1]], positions[v[2]]);
+			if (before.dotProduct(after) <= 0.f)
+			{
+				flipped = true;
+				break;
+			}
+		}
+		if (flipped)
+			continue;
+
+		for (int t : vertexTris[c.from])
+		{
+			if (!triAlive[t])
+				continue;
+			auto& tri = tris[t];
+			if (tri.x == c.to || tri.y == c.to || tri.z == c.to)
+			{
+				triAlive[t] = false;
+				--liveTris;
+				continue;
+			}
+			if (tri.x == c.from) tri.x = c.to;
+			if (tri.y == c.from) tri.y = c.to;
+			if (tri.z == c.from) tri.z = c.to;
+			vertexTris[c.to].push_back(t);
+		}
+
+		vertexAlive[c.from] = false;
+		vertexTris[c.from].clear();
+		quadrics[c.to].add(quadrics[c.from]);
+		maxCost = std::max(maxCost, c.cost);
+		++stamps[c.to];
+
+		// the quadric of c.to has changed, re-evaluate every edge around it
+		neighbors.clear();
+		auto& adj = vertexTris[c.to];
+		adj.erase(std::remove_if(adj.begin(), adj.end(), [&](int t) { return !triAlive[t]; }), adj.end());
+		for (int t : adj)
+		{
+			for (int k : { tris[t].x, tris[t].y, tris[t].z })
+			{
+				if (k != c.to)
+					neighbors.push_back(k);
+			}
+		}
+		std::sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+		for (int k : neighbors)
+		{
+			pushCollapse(k, c.to);
+			pushCollapse(c.to, k);
+		}
+	}
+
+	std::vector<Vector3i> res;
+	res.reserve(liveTris);
+	for (int i = 0; i < static_cast<int>(tris.size()); ++i)
+	{
+		if (triAlive[i])
+			res.push_back(tris[i]);
+	}
+
+	error = static_cast<float>(std::sqrt(std::max(0.0, maxCost)));
+	return res;
+}
\ No newline at end of file
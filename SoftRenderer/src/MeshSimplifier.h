@@ -0,0 +1,36 @@
+#ifndef M_MESH_SIMPLIFIER_H
+#define M_MESH_SIMPLIFIER_H
+
+#include "Math.h"
+#include <vector>
+#include <utility>
+
+// quadric-error-metric simplifier, collapses edges onto one of their endpoints,
+// so the vertex buffer (uv, normal, bone weights) is shared by every lod and only indices change.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(const std::vector<Vector3f>& positions,
+		const std::vector<Vector3f>& normals,
+		const std::vector<Vector2f>& uvs,
+		const std::vector<std::vector<std::pair<int, float>>>& boneWeight);
+
+	// stops at targetTriCount triangles, or before the first collapse whose error exceeds maxError.
+	// error : max object-space distance between the result and the input surface
+	std::vector<Vector3i> simplify(const std::vector<Vector3i>& indices, size_t targetTriCount, float maxError, float& error) const;
+
+private:
+	const std::vector<Vector3f>& positions;
+
+	// vertices with identical attributes are welded onto one representative,
+	// vertices sharing a position but not the attributes (uv seams, hard edges, bone seams) are locked.
+	std::vector<int> remap;
+	std::vector<bool> locked;
+
+	bool sameAttributes(int a, int b,
+		const std::vector<Vector3f>& normals,
+		const std::vector<Vector2f>& uvs,
+		const std::vector<std::vector<std::pair<int, float>>>& boneWeight) const;
+};
+
+#endif
\ No newline at end of file
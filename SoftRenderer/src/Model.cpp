@@ -1,36 +1,202 @@
 #include "Model.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "FrameArena.h"
+#include "TextureCache.h"
 
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <queue>
+#include <limits>
+#include <cmath>
 
 using namespace std;
 
+Model::~Model()
+{
+	cancel = true;
+	if (loader.joinable())
+		loader.join();
+}
+
+// one scene per model: the importer frees the last one, which the channels and animation of its
+// meshes point into. unload() first
+bool Model::isEmpty() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return meshes.empty() && meshFinished.empty();
+}
+
 void Model::load(const string &path)
 {
-	unsigned int assimp_read_flag = aiProcess_Triangulate |
-		aiProcess_SortByPType |
-		aiProcess_GenUVCoords |
-		aiProcess_OptimizeMeshes |
-		aiProcess_ValidateDataStructure |
-		aiProcess_GenNormals |
-		aiProcess_CalcTangentSpace |
-		aiProcess_LimitBoneWeights |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_FlipWindingOrder;
+	assert(isEmpty());
+	if (!isEmpty())
+	{
+		cout << "ERROR::MODEL::already holds a scene, unload it before loading " << path << endl;
+		return;
+	}
+
+	int firstTexture = static_cast<int>(textureSources.size());
+	if (!importScene(path))
+		return;
+
+	for (const auto& source : meshSources)
+		meshes.push_back(processMesh(source));
+	textureVec.resize(textureSources.size());
+	for (int i = firstTexture; i < static_cast<int>(textureSources.size()); ++i)
+		textureVec[i] = decodeTexture(textureSources[i]);
+}
+
+void Model::loadAsync(const string& path)
+{
+	if (loader.joinable())
+		loader.join();
+	assert(isEmpty());
+	if (!isEmpty())
+	{
+		cout << "ERROR::MODEL::already holds a scene, unload it before loading " << path << endl;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		loading = true;
+	}
+
+	loader = std::thread([this, path] {
+		int firstTexture = static_cast<int>(textureSources.size());
+		if (importScene(path))
+		{
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				textureCount = static_cast<int>(textureSources.size());
+				finishedMeshes.resize(meshSources.size());
+				meshFinished.resize(meshSources.size(), false);
+			}
+
+			// the meshes come first, they are what the first frames show
+			nextJob = 0;
+			int jobCount = static_cast<int>(meshSources.size() + textureSources.size()) - firstTexture;
+			int helperCount = std::min(static_cast<int>(std::thread::hardware_concurrency()), jobCount) - 1;
+			std::vector<std::thread> helpers;
+			for (int i = 0; i < helperCount; ++i)
+				helpers.emplace_back(&Model::loadJobs, this, firstTexture);
+			loadJobs(firstTexture);
+			for (auto& helper : helpers)
+				helper.join();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			loading = false;
+		}
+		doneCv.notify_all();
+	});
+}
+
+// meshes and textures of an async load until there are none left, on the loader and its helpers
+void Model::loadJobs(int firstTexture)
+{
+	int meshCount = static_cast<int>(meshSources.size());
+	int jobCount = meshCount + static_cast<int>(textureSources.size()) - firstTexture;
+	for (int job = nextJob++; job < jobCount && !cancel; job = nextJob++)
+	{
+		if (job < meshCount)
+		{
+			auto mesh = processMesh(meshSources[job]);
+			std::lock_guard<std::mutex> lock(mtx);
+			finishedMeshes[job] = std::move(mesh);
+			meshFinished[job] = true;
+		}
+		else
+		{
+			int idx = firstTexture + job - meshCount;
+			auto texture = decodeTexture(textureSources[idx]);
+			std::lock_guard<std::mutex> lock(mtx);
+			readyTextures.emplace_back(idx, std::move(texture));
+		}
+	}
+}
+
+int Model::update(Renderer& renderer)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		// a mesh waits for the ones before it
+		while (publishedMeshes < static_cast<int>(meshFinished.size()) && meshFinished[publishedMeshes])
+			arrivedMeshes.push_back(std::move(finishedMeshes[publishedMeshes++]));
+		arrivedTextures.swap(readyTextures);
+		if (static_cast<int>(textureVec.size()) < textureCount)
+			textureVec.resize(textureCount);
+	}
+
+	for (auto& texture : arrivedTextures)
+		textureVec[texture.first] = std::move(texture.second);
+	for (auto& mesh : arrivedMeshes)
+	{
+		meshes.push_back(std::move(mesh));
+		meshes.back().addToRenderer(&renderer, vertexFormat);
+	}
+
+	int count = static_cast<int>(arrivedMeshes.size() + arrivedTextures.size());
+	arrivedMeshes.clear();
+	arrivedTextures.clear();
+	return count;
+}
+
+void Model::unload(Renderer& renderer)
+{
+	cancel = true;
+	if (loader.joinable())
+		loader.join();
+	cancel = false;
+
+	for (auto& mesh : meshes)
+		mesh.removeFromRenderer(&renderer);
+	meshes.clear();
+	textureVec.clear();
+	textureMap.clear();
+	meshSources.clear();
+	textureSources.clear();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	finishedMeshes.clear();
+	meshFinished.clear();
+	publishedMeshes = 0;
+	textureCount = 0;
+	readyTextures.clear();
+}
+
+bool Model::isLoading() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return loading;
+}
+
+void Model::wait()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	doneCv.wait(lock, [&] { return !loading; });
+}
+
+// the scene and what is in it: the meshes to convert and the textures to decode
+bool Model::importScene(const string& path)
+{
 	// the property must be false, for fixing some mixamo-anim problem.
 	import.SetPropertyBool(AI_CONFIG_IMPORT_FBX_PRESERVE_PIVOTS, false);
+	// only triangulated, MeshOptimizer welds and reorders the vertices of each mesh after the import
 	scene = import.ReadFile(path, aiProcess_Triangulate);
 
 	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 	{
 		cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
-		return;
+		return false;
 	}
 
 	directory = path.substr(0, path.find_last_of('/'));
+	meshSources.clear();
 	processNode(scene->mRootNode);
+	return true;
 }
 
 void processAnim(aiAnimation* anim, Mesh* mesh)
@@ -47,7 +213,8 @@ void Model::processNode(aiNode* node)
 	for (int i = 0; i < node->mNumMeshes; ++i)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh));
+		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		meshSources.push_back({ mesh, processTexture(aiTextureType_DIFFUSE, material), processTexture(aiTextureType_SPECULAR, material) });
 	}
 
 	for (int i = 0; i < node->mNumChildren; ++i)
@@ -56,36 +223,73 @@ void Model::processNode(aiNode* node)
 	}
 }
 
-void Mesh::addToRenderer(Renderer* render)
+void Mesh::addToRenderer(Renderer* render, VertexLayout layout)
 {
-	posbufId = render->addPositionBuf(std::move(positions));
-	norbufId = render->addNormalBuf(std::move(normals));
-	uvbufId = render->addUVBuf(std::move(uvCoords));
+	std::vector<float> vertices;
+	VertexFormat::interleave(positions, normals, uvCoords, layout, vertices);
+	vtxbufId = render->addVertexBuf(std::move(vertices), layout);
+
+	// the renderer owns the vertex data now
+	std::vector<Vector3f>().swap(positions);
+	std::vector<Vector3f>().swap(normals);
+	std::vector<Vector2f>().swap(uvCoords);
+
 	indbufId = render->addIndexBuf(std::move(indices));
 	boneWeightBufId = render->addBoneWeightBuf(std::move(boneWeight));
+
+	for (auto& lod : lods)
+		lod.indbufId = render->addIndexBuf(std::move(lod.indices));
 }
-void Mesh::setDrawParams(DrawParams& dp, float timeInSecs)
+
+void Mesh::removeFromRenderer(Renderer* render)
+{
+	render->releaseBuf(vtxbufId);
+	render->releaseBuf(indbufId);
+	render->releaseBuf(boneWeightBufId);
+	for (const auto& lod : lods)
+		render->releaseBuf(lod.indbufId);
+}
+void Mesh::setDrawParams(DrawParams& dp, float timeInSecs) const
 {
-	dp.posId = posbufId;
-	dp.norId = norbufId;
-	dp.uvId = uvbufId;
+	setBuffers(dp);
+	if(this->anim != nullptr)
+		getBoneTransform(timeInSecs, dp.boneTransform);
+}
+
+void Mesh::setDrawParams(DrawParams& dp, const std::vector<Matrix4f>& pose) const
+{
+	setBuffers(dp);
+	// assigned, the vector of dp keeps its storage from frame to frame
+	dp.boneTransform = pose;
+}
+
+// what the mesh draws with, except its pose
+void Mesh::setBuffers(DrawParams& dp) const
+{
+	dp.vtxId = vtxbufId;
+	dp.posId = {};
+	dp.norId = {};
+	dp.uvId = {};
 	dp.indId = indbufId;
 	dp.boneWeightId = boneWeightBufId;
 
-	dp.fsParams.Ka = material.Ka;
-	dp.fsParams.Kd = material.Kd;
-	dp.fsParams.Ks = material.Ks;
-	dp.fsParams.Ns = material.Ns;
+	dp.lods.clear();
+	if (!lods.empty())
+	{
+		dp.lods.push_back({ indbufId, 0.f });
+		for (const auto& lod : lods)
+			dp.lods.push_back({ lod.indbufId, lod.error });
+	}
+	dp.boundCenter = boundCenter;
+	dp.boundRadius = boundRadius;
 
-	dp.fsParams.diffuseTextureIdx = this->diffuseTextureIdx;
-	dp.fsParams.specularTextureIdx = this->specularTextureIdx;
-	
-	if(this->anim != nullptr)
-		getBoneTransform(timeInSecs, dp.boneTransform);
+	material.bind(dp);
 }
 
-Mesh Model::processMesh(aiMesh* mesh)
+// only reads the scene, several meshes convert at once
+Mesh Model::processMesh(const MeshSource& source)
 {
+	aiMesh* mesh = source.mesh;
 	Mesh res;
 	res.scene = scene;
 
@@ -117,6 +321,10 @@ Mesh Model::processMesh(aiMesh* mesh)
 		res.indices.push_back(Vector3i{ static_cast<int>(face.mIndices[0]), static_cast<int>(face.mIndices[1]), static_cast<int>(face.mIndices[2])});
 	}
 
+	Vector3f tka{ 0, 0, 0 };
+	Vector3f tkd{ 0, 0, 0 };
+	Vector3f tks{ 0, 0, 0 };
+	float shine = 0.0;
 	if (mesh->mMaterialIndex >= 0)
 	{
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
@@ -124,21 +332,16 @@ Mesh Model::processMesh(aiMesh* mesh)
 		aiColor3D ka;
 		aiColor3D kd;
 		aiColor3D ks;
-		float shine = 0.0;
 		material->Get(AI_MATKEY_COLOR_AMBIENT, ka);
 		material->Get(AI_MATKEY_COLOR_DIFFUSE, kd);
 		material->Get(AI_MATKEY_COLOR_SPECULAR, ks);
 		material->Get(AI_MATKEY_SHININESS, shine);
 
-		processTexture(aiTextureType_DIFFUSE, &res, material);
-		processTexture(aiTextureType_SPECULAR, &res, material);
-
-		Vector3f tka{ ka.r, ka.g, ka.b };
-		Vector3f tkd{ kd.r,kd.g,kd.b };
-		Vector3f tks{ ks.r, ks.g, ks.b };
-		
-		res.material = { tka, tkd, tks, shine };
+		tka = { ka.r, ka.g, ka.b };
+		tkd = { kd.r,kd.g,kd.b };
+		tks = { ks.r, ks.g, ks.b };
 	}
+	res.material = Material(tka, tkd, tks, shine, source.diffuseTextureIdx, source.specularTextureIdx);
 
 	// has bones and animations
 	if (mesh->HasBones())
@@ -188,6 +391,7 @@ Mesh Model::processMesh(aiMesh* mesh)
 			assert(scene->mNumAnimations <= 1);
 			auto anim = scene->mAnimations[0];
 			res.anim = anim;
+			res.buildAnimNodes(scene->mRootNode, -1);
 
 			//for (int i = 0; i < anim->mNumChannels; ++i)
 			//{
@@ -210,96 +414,207 @@ Mesh Model::processMesh(aiMesh* mesh)
 		}
 	}
 
+	// welded and reordered whatever the importer did, the lods are simplified from the result
+	MeshOptimizer::Stats before, after;
+	MeshOptimizer::optimize(res.positions, res.normals, res.uvCoords, res.boneWeight, res.indices, &before, &after);
+	printf("mesh %s: %d -> %d vertices, %d -> %d triangles, %.2f -> %.2f vertex misses per triangle\n", mesh->mName.C_Str(),
+		before.vertexCount, after.vertexCount, before.triangleCount, after.triangleCount, before.acmr, after.acmr);
+
+	res.buildLods();
+	res.buildBoneBounds();
+	for (auto& lod : res.lods)
+		MeshOptimizer::optimizeTriangles(res.positions, lod.indices);
+
 	return res;
 }
 
-void Mesh::getBoneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms)
+void Mesh::buildBoneBounds()
 {
-	if (anim == nullptr)
+	float inf = std::numeric_limits<float>::max();
+	boneBounds.assign(boneVec.size(), Aabb{ Vector3f(inf, inf, inf), Vector3f(-inf, -inf, -inf) });
+	for (int i = 0; i < static_cast<int>(boneWeight.size()); ++i)
+	{
+		const auto& p = positions[i];
+		for (const auto& pairW : boneWeight[i])
+		{
+			auto& box = boneBounds[pairW.first];
+			box.min = Vector3f{ std::min(box.min.x, p.x), std::min(box.min.y, p.y), std::min(box.min.z, p.z) };
+			box.max = Vector3f{ std::max(box.max.x, p.x), std::max(box.max.y, p.y), std::max(box.max.z, p.z) };
+		}
+	}
+}
+
+void Mesh::getPosedBounds(const std::vector<Matrix4f>& pose, Vector3f& center, float& radius) const
+{
+	center = boundCenter;
+	radius = boundRadius;
+
+	float inf = std::numeric_limits<float>::max();
+	Vector3f minP(inf, inf, inf);
+	Vector3f maxP(-inf, -inf, -inf);
+	int count = std::min(static_cast<int>(pose.size()), static_cast<int>(boneBounds.size()));
+	for (int i = 0; i < count; ++i)
+	{
+		const auto& box = boneBounds[i];
+		if (box.min.x > box.max.x)
+			continue;
+
+		// the box around the moved box, like Scene does for world transforms
+		const auto& m = pose[i].num;
+		auto c = 0.5f * (box.min + box.max);
+		auto e = 0.5f * (box.max - box.min);
+		auto pc = pose[i] * Vector4f{ c.x, c.y, c.z, 1.f };
+		Vector3f pe(
+			std::abs(m[0]) * e.x + std::abs(m[1]) * e.y + std::abs(m[2]) * e.z,
+			std::abs(m[4]) * e.x + std::abs(m[5]) * e.y + std::abs(m[6]) * e.z,
+			std::abs(m[8]) * e.x + std::abs(m[9]) * e.y + std::abs(m[10]) * e.z);
+		minP = Vector3f{ std::min(minP.x, pc.x - pe.x), std::min(minP.y, pc.y - pe.y), std::min(minP.z, pc.z - pe.z) };
+		maxP = Vector3f{ std::max(maxP.x, pc.x + pe.x), std::max(maxP.y, pc.y + pe.y), std::max(maxP.z, pc.z + pe.z) };
+	}
+	if (minP.x > maxP.x)
 		return;
-	float TicksPerSecond = anim->mTicksPerSecond;
-	float TimeInTicks = TimeInSeconds * TicksPerSecond;
-	float AnimationTime = std::fmodf(TimeInTicks, anim->mDuration);
 
-	Matrix4f identity = Matrix4f::Identity();
-	ReadNodeHierarchy(AnimationTime, scene->mRootNode, identity);
-	
-	Transforms.resize(this->boneVec.size());
+	center = 0.5f * (minP + maxP);
+	radius = 0.5f * (maxP - minP).length();
+}
 
-	// -------------------
-	for (int i = 0; i < this->boneVec.size(); ++i)
+void Mesh::buildLods(int maxLodCount, float reduction)
+{
+	lods.clear();
+	if (positions.empty())
+		return;
+
+	Vector3f minP = positions[0];
+	Vector3f maxP = positions[0];
+	for (const auto& p : positions)
 	{
-		Transforms[i] = boneVec[i].finalTransformation;
+		minP = Vector3f{ std::min(minP.x, p.x), std::min(minP.y, p.y), std::min(minP.z, p.z) };
+		maxP = Vector3f{ std::max(maxP.x, p.x), std::max(maxP.y, p.y), std::max(maxP.z, p.z) };
+	}
+	boundCenter = 0.5f * (minP + maxP);
+	boundRadius = 0.f;
+	for (const auto& p : positions)
+		boundRadius = std::max(boundRadius, (p - boundCenter).length());
+
+	// every level is simplified from the previous one, so the error is accumulated along the chain
+	MeshSimplifier simplifier(positions, normals, uvCoords, boneWeight);
+	const std::vector<Vector3i>* src = &indices;
+	float accumError = 0.f;
+	for (int i = 0; i < maxLodCount; ++i)
+	{
+		auto target = static_cast<size_t>(src->size() * reduction);
+		if (target < 16)
+			break;
+
+		// a single level must not drift further than a tenth of the mesh size
+		float error = 0.f;
+		auto simplified = simplifier.simplify(*src, target, boundRadius * 0.1f, error);
+
+		// stop when the locked seams and borders prevent any meaningful reduction
+		if (simplified.size() > src->size() * 0.9f)
+			break;
+
+		accumError += error;
+		lods.push_back({ std::move(simplified), accumError, ind_buf_id() });
+		src = &lods.back().indices;
 	}
 }
 
-void Mesh::ReadNodeHierarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform)
+void Mesh::buildAnimNodes(const aiNode* pNode, int parent)
 {
 	// pNode might be not a bone node
 	string NodeName(pNode->mName.data);
 
+	AnimNode node;
 	auto& t = pNode->mTransformation;
-	Matrix4f NodeTransformation = {
+	node.transformation = {
 		t.a1, t.a2, t.a3, t.a4,
 		t.b1, t.b2, t.b3, t.b4,
 		t.c1, t.c2, t.c3, t.c4,
 		t.d1, t.d2, t.d3, t.d4,
 	};
+	node.parent = parent;
 
-	const aiNodeAnim* pNodeAnim = FindNodeAnim(anim, pNode->mName.C_Str());
-
-	if (pNodeAnim && boneMap.find(NodeName) != boneMap.end())
+	auto bone = boneMap.find(NodeName);
+	if (bone != boneMap.end())
 	{
-		// interpolate scaling
-		aiVector3D Scaling;
-		CalcInterpolatedScaling(Scaling, AnimationTime, pNodeAnim);
-		Matrix4f ScalingM = {
-			Scaling.x, 0, 0, 0,
-			0, Scaling.y, 0, 0,
-			0, 0, Scaling.z, 0,
-			0, 0, 0, 1
-		};
-
-		// interpolate rotation and generate rotation transformation matrix
-		aiQuaternion RotationQ;
-		CalcInterpolatedRotation(RotationQ, AnimationTime, pNodeAnim);
-		auto t = RotationQ.GetMatrix();
-		Matrix4f RotationM = Matrix4f{
-			t.a1, t.a2, t.a3, 0,
-			t.b1, t.b2, t.b3, 0,
-			t.c1, t.c2, t.c3, 0,
-			0, 0, 0, 1
-		};
-
-		// interpolate translation
-		aiVector3D Translation;
-		CalcInterpolatedPosition(Translation, AnimationTime, pNodeAnim);
-		Matrix4f TranslationM = {
-			1, 0, 0, Translation.x,
-			0, 1, 0, Translation.y,
-			0, 0, 1, Translation.z,
-			0, 0, 0, 1
-		};
-
-		NodeTransformation = TranslationM * RotationM * ScalingM;
+		node.boneId = bone->second;
+		node.channel = FindNodeAnim(anim, NodeName);
 	}
 
-	Matrix4f GlobalTransformation = ParentTransform * NodeTransformation;
-
-	if (boneMap.find(NodeName) != boneMap.end()) 
+	int idx = static_cast<int>(animNodes.size());
+	animNodes.push_back(node);
+	for (int i = 0; i < static_cast<int>(pNode->mNumChildren); ++i)
 	{
-		auto boneid = boneMap[NodeName];
-		boneVec[boneid].finalTransformation = /*m_GlobalInverseTransform **/ GlobalTransformation * boneVec[boneid].offsetMatrix;
+		buildAnimNodes(pNode->mChildren[i], idx);
 	}
+}
+
+void Mesh::getBoneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms) const
+{
+	if (anim == nullptr)
+		return;
+	float TicksPerSecond = anim->mTicksPerSecond;
+	float TimeInTicks = TimeInSeconds * TicksPerSecond;
+	float AnimationTime = std::fmodf(TimeInTicks, anim->mDuration);
+
+	// written straight into the output, the mesh itself stays untouched
+	Transforms.resize(this->boneVec.size());
 
-	for (int i = 0; i < pNode->mNumChildren; ++i)
+	// parents come first, their global transform is ready when a child needs it
+	FrameVector<Matrix4f> GlobalTransformations(animNodes.size());
+	for (int i = 0; i < static_cast<int>(animNodes.size()); ++i)
 	{
-		ReadNodeHierarchy(AnimationTime, pNode->mChildren[i], GlobalTransformation);
+		const auto& node = animNodes[i];
+		Matrix4f NodeTransformation = node.transformation;
+		if (node.channel)
+			NodeTransformation = getAnimatedTransform(AnimationTime, node.channel);
+
+		Matrix4f ParentTransform = node.parent == -1 ? Matrix4f::Identity() : GlobalTransformations[node.parent];
+		GlobalTransformations[i] = ParentTransform * NodeTransformation;
+
+		if (node.boneId != -1)
+			Transforms[node.boneId] = /*m_GlobalInverseTransform **/ GlobalTransformations[i] * boneVec[node.boneId].offsetMatrix;
 	}
+}
+
+Matrix4f Mesh::getAnimatedTransform(float AnimationTime, const aiNodeAnim* pNodeAnim) const
+{
+	// interpolate scaling
+	aiVector3D Scaling;
+	CalcInterpolatedScaling(Scaling, AnimationTime, pNodeAnim);
+	Matrix4f ScalingM = {
+		Scaling.x, 0, 0, 0,
+		0, Scaling.y, 0, 0,
+		0, 0, Scaling.z, 0,
+		0, 0, 0, 1
+	};
 
+	// interpolate rotation and generate rotation transformation matrix
+	aiQuaternion RotationQ;
+	CalcInterpolatedRotation(RotationQ, AnimationTime, pNodeAnim);
+	auto t = RotationQ.GetMatrix();
+	Matrix4f RotationM = Matrix4f{
+		t.a1, t.a2, t.a3, 0,
+		t.b1, t.b2, t.b3, 0,
+		t.c1, t.c2, t.c3, 0,
+		0, 0, 0, 1
+	};
+
+	// interpolate translation
+	aiVector3D Translation;
+	CalcInterpolatedPosition(Translation, AnimationTime, pNodeAnim);
+	Matrix4f TranslationM = {
+		1, 0, 0, Translation.x,
+		0, 1, 0, Translation.y,
+		0, 0, 1, Translation.z,
+		0, 0, 0, 1
+	};
+
+	return TranslationM * RotationM * ScalingM;
 }
 
-void Mesh::CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim)
+void Mesh::CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) const
 {
 	// we need at least two values to interpolate
 	if (pNodeAnim->mNumPositionKeys == 1)
@@ -335,7 +650,7 @@ void Mesh::CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, c
 	Out = start + factor * delta;
 }
 
-void Mesh::CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTick, const aiNodeAnim* pNodeAnim)
+void Mesh::CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTick, const aiNodeAnim* pNodeAnim) const
 {
 	// we need at least two values to interpolate
 	if (pNodeAnim->mNumRotationKeys == 1) {
@@ -370,7 +685,7 @@ void Mesh::CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTick,
 	Out = Out.Normalize();
 }
 
-void Mesh::CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim)
+void Mesh::CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) const
 {
 	// we need at least two values to interpolate
 	if (pNodeAnim->mNumScalingKeys == 1)
@@ -407,7 +722,7 @@ void Mesh::CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, co
 }
 
 
-aiNodeAnim* Mesh::FindNodeAnim(aiAnimation* pAnim, const std::string& nodeName)
+aiNodeAnim* Mesh::FindNodeAnim(aiAnimation* pAnim, const std::string& nodeName) const
 {
 	for (int i = 0; i < pAnim->mNumChannels; ++i)
 	{
@@ -446,17 +761,11 @@ aiNode* Mesh::findAnimRootBone()
 }
 
 
-void Model::processTexture(aiTextureType type, Mesh* mesh, aiMaterial *material)
+// the index in textureVec of the texture of the material, registered for decoding the first time
+int Model::processTexture(aiTextureType type, aiMaterial *material)
 {
+	int idx = -1;
 	auto count = material->GetTextureCount(type);
-	if (count == 0)
-	{
-		if (type == aiTextureType_DIFFUSE)
-			mesh->diffuseTextureIdx = -1;
-		else if (type == aiTextureType_SPECULAR)
-			mesh->specularTextureIdx = -1;
-		return;
-	}
 	for (int i = 0; i < count; ++i)
 	{
 		aiString tpath;
@@ -464,54 +773,45 @@ void Model::processTexture(aiTextureType type, Mesh* mesh, aiMaterial *material)
 
 		auto allPathS = directory + "/" + tpath.C_Str();
 
-		int idx = -1;
 		auto it = textureMap.find(allPathS);
 		if (it == textureMap.end())
 		{
 			ifstream f(allPathS.c_str());
 			// if file not exist, it might to be a embedded texture, read it from memory
-			if (f.good())
+			const aiTexture* embedded = nullptr;
+			if (!f.good())
 			{
-				auto newTexture = make_shared<Texture>(allPathS.c_str());
-				textureVec.push_back(newTexture);
-				idx = textureVec.size() - 1;
-				textureMap.insert({ allPathS, idx });
-			}
-			else
-			{
-				auto texture = scene->GetEmbeddedTexture(allPathS.c_str());
+				embedded = scene->GetEmbeddedTexture(allPathS.c_str());
 				// If this value is zero, pcData points to an compressed texture in any format (e.g. JPEG).
-				if (texture->mHeight == 0)
-				{
-					auto stream = SDL_RWFromMem(static_cast<void*>(texture->pcData), texture->mWidth);
-					if (stream == NULL)
-					{
-						std::cout << "read texture from memory error." << std::endl;
-					}
-					auto newTexture = make_shared<Texture>(stream);
-					if (SDL_RWclose(stream) < 0)
-					{
-						std::cout << "close sdl_rw error." << std::endl;
-					}
-
-					textureVec.push_back(newTexture);
-					idx = textureVec.size() - 1;
-					textureMap.insert({ allPathS, idx });
-				}
-				else
+				if (embedded == nullptr || embedded->mHeight != 0)
 				{
 					std::cout << "not a compressed texture." << std::endl;
+					idx = -1;
+					continue;
 				}
 			}
+			idx = static_cast<int>(textureSources.size());
+			textureSources.push_back({ allPathS, embedded });
+			textureMap.insert({ allPathS, idx });
 		}
 		else
 		{
 			idx = it->second;
 		}
-
-		if (type == aiTextureType_DIFFUSE)
-			mesh->diffuseTextureIdx = idx;
-		else if (type == aiTextureType_SPECULAR)
-			mesh->specularTextureIdx = idx;
 	}
+	return idx;
+}
+
+// either way the image is decoded once per process, models sharing it share the texture
+std::shared_ptr<Texture> Model::decodeTexture(const TextureSource& source)
+{
+	if (source.embedded == nullptr)
+		return TextureCache::global().load(source.path);
+
+	// compressed embedded textures name their format in the hint, e.g. "tga"
+	const char* hint = source.embedded->achFormatHint;
+	auto texture = TextureCache::global().load(source.embedded->pcData, source.embedded->mWidth, hint[0] != '\0' ? hint : nullptr);
+	if (!texture)
+		std::cout << "read texture from memory error." << std::endl;
+	return texture;
 }
\ No newline at end of file
@@ -9,21 +9,34 @@
 #include <assimp/postprocess.h>
 #include <cassert>
 #include "Renderer.h"
+#include "Material.h"
+#include "DynamicBvh.h"
 #include <unordered_map>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 struct Bone
 {
 	Matrix4f offsetMatrix;
-	Matrix4f finalTransformation;
 };
 
-struct Material
+// a node of the scene hierarchy, flattened so posing walks an array instead of looking names up
+struct AnimNode
 {
-	Vector3f Ka;
-	Vector3f Kd;
-	Vector3f Ks;
-	float Ns;
+	Matrix4f transformation;					// relative to the parent, when not animated
+	int parent = -1;							// index in Mesh::animNodes, parents come first
+	int boneId = -1;
+	const aiNodeAnim* channel = nullptr;		// only for the bones of the mesh
+};
+
+struct MeshLod
+{
+	std::vector<Vector3i> indices;
+	float error = 0.f;			// object-space geometric error against the full mesh
+	ind_buf_id indbufId;
 };
 
 struct Mesh
@@ -39,32 +52,51 @@ struct Mesh
 	std::vector<std::vector<std::pair<int, float>>> boneWeight;		// posid -> vec<boneid | weight>;
 	std::unordered_map<std::string, int> boneMap;
 	std::vector<Bone> boneVec;
+	std::vector<AnimNode> animNodes;
+
+	// lods[0] is the first simplified level, the full mesh is indices/indbufId
+	std::vector<MeshLod> lods;
+	Vector3f boundCenter;
+	float boundRadius = 0.f;
+
+	// bind-pose box of the vertices each bone moves, bone id -> box, empty (min > max) if it moves none
+	std::vector<Aabb> boneBounds;
 
-	pos_buf_id posbufId;
-	nor_buf_id norbufId;
-	uv_buf_id uvbufId;
+	vtx_buf_id vtxbufId;		// interleaved position, normal, uv, see VertexFormat
 	ind_buf_id indbufId;
 	bone_weight_buf_id boneWeightBufId;
 
 	Material material;
-	
-	int diffuseTextureIdx;
-	int specularTextureIdx;
 
-	void addToRenderer(Renderer* render);
-	void setDrawParams(DrawParams& dp, float timeInSecs = 0.0f);
+	void buildLods(int maxLodCount = 4, float reduction = 0.5f);
+	// before addToRenderer takes the bone weights
+	void buildBoneBounds();
+	// once anim is set, from the root node of the scene
+	void buildAnimNodes(const aiNode* pNode, int parent);
+	// layout : the formats of the vertex buffer, floats by default
+	void addToRenderer(Renderer* render, VertexLayout layout = VertexLayout());
+	void removeFromRenderer(Renderer* render);
+	// const, so several threads can pose the same mesh at different times
+	void setDrawParams(DrawParams& dp, float timeInSecs = 0.0f) const;
+	// with a pose computed beforehand by getBoneTransform, so passes drawing the mesh in the same frame pose it once
+	void setDrawParams(DrawParams& dp, const std::vector<Matrix4f>& pose) const;
+	// bone id -> transform at the time, untouched without an animation
+	void getBoneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms) const;
+	// sphere around the mesh in a pose from getBoneTransform, the bind-pose one without bones.
+	// a skinned vertex is a blend of its bones moving it, so it stays in the box of their moved boxes
+	void getPosedBounds(const std::vector<Matrix4f>& pose, Vector3f& center, float& radius) const;
 	//Matrix4f m_GlobalInverseTransform;
 
 	// the root bone of mixamo-animation is not RootNode( scene-> mRootNode ), in fact it is the mixamorig-Hip
 	// so we travel from mRootNode to the leaf, to find the first Bone as the root bone.
 	aiNode* findAnimRootBone();
 private:
-	void getBoneTransform(float TimeInSeconds, std::vector<Matrix4f>& Transforms);
-	void ReadNodeHierarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform);
-	aiNodeAnim* FindNodeAnim(aiAnimation* pAnim, const std::string &nodeName);
-	void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim);
-	void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim);
-	void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim);
+	void setBuffers(DrawParams& dp) const;
+	Matrix4f getAnimatedTransform(float AnimationTime, const aiNodeAnim* pNodeAnim) const;
+	aiNodeAnim* FindNodeAnim(aiAnimation* pAnim, const std::string &nodeName) const;
+	void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) const;
+	void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) const;
+	void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTimeTicks, const aiNodeAnim* pNodeAnim) const;
 
 
 };
@@ -72,19 +104,80 @@ private:
 class Model
 {
 public:
+	~Model();
+
+	// a model holds one scene, loading another one needs unload() first
 	void load(const std::string& path);
+	// returns at once: the import runs on a thread of its own, then the meshes are converted and the
+	// textures decoded on every core. update() hands over what finished, the model is loading until
+	// isLoading() is false. the textures of a mesh may come after it, see textureVec
+	void loadAsync(const std::string& path);
+	// render thread, between frames: appends the meshes that finished, in the order of the scene, to meshes
+	// and adds them to renderer,
+	// fills in the textures that finished. returns how many meshes and textures came in
+	int update(Renderer& renderer);
+	bool isLoading() const;
+	// until every mesh and texture is finished, update() still has to hand them over
+	void wait();
+	// stops a load and releases the buffers of the meshes from renderer, draws still holding their
+	// handles are skipped by it. the model is empty afterwards
+	void unload(Renderer& renderer);
+
+	// for the meshes update() adds to the renderer, see VertexLayout
+	VertexLayout vertexFormat;
+
 	std::vector<Mesh> meshes;
+	// from TextureCache::global(), shared with every other model using the same images.
+	// nullptr while it is decoded or when it can't be, the material color stands in for it
 	std::vector<std::shared_ptr<Texture>> textureVec;
 	std::unordered_map<std::string, int> textureMap;
 
 private:
+	struct MeshSource
+	{
+		aiMesh* mesh;
+		int diffuseTextureIdx;
+		int specularTextureIdx;
+	};
+
+	struct TextureSource
+	{
+		std::string path;
+		const aiTexture* embedded;		// when there is no file at path
+	};
+
+	bool isEmpty() const;
+	bool importScene(const std::string& path);
 	void processNode(aiNode* node);
-	void processTexture(aiTextureType type, Mesh* mesh, aiMaterial *material);
-	Mesh processMesh(aiMesh* mesh);
+	int processTexture(aiTextureType type, aiMaterial *material);
+	Mesh processMesh(const MeshSource& source);
+	std::shared_ptr<Texture> decodeTexture(const TextureSource& source);
+	void loadJobs(int firstTexture);
 
 	Assimp::Importer import;
-	const aiScene* scene;
+	const aiScene* scene = nullptr;
 	std::string directory;
+	// the meshes in the order of the nodes and the textures of their materials, found by processNode
+	std::vector<MeshSource> meshSources;
+	std::vector<TextureSource> textureSources;
+
+	// async load, the sources are written by the loader before the jobs start
+	std::thread loader;
+	std::atomic<int> nextJob{ 0 };		// meshes first, then textures
+	std::atomic<bool> cancel{ false };
+	mutable std::mutex mtx;
+	std::condition_variable doneCv;
+	bool loading = false;
+	int textureCount = 0;
+	// at the index of their source whatever thread finished them first, update() hands them over in
+	// that order so the meshes, their scene nodes and the draws are the same from run to run
+	std::vector<Mesh> finishedMeshes;
+	std::vector<bool> meshFinished;
+	int publishedMeshes = 0;
+	std::vector<std::pair<int, std::shared_ptr<Texture>>> readyTextures;
+	// what update() took from the ready ones, kept so steady frames don't allocate
+	std::vector<Mesh> arrivedMeshes;
+	std::vector<std::pair<int, std::shared_ptr<Texture>>> arrivedTextures;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+OcclusionCuller::OcclusionCuller(const Renderer& source, int downscale)
+	: source(source), renderer(std::max(1, source.getWidth() / downscale), std::max(1, source.getHeight() / downscale)), downscale(downscale)
+{
+	renderer.shareBuffers(source);
+	renderer.setRenderPass(RenderPass::DepthOnly);
+	renderer.setConservativeDepth(true);
+}
+
+void OcclusionCuller::begin()
+{
+	renderer.setResolution(std::max(1, source.getWidth() / downscale), std::max(1, source.getHeight() / downscale));
+	renderer.setVertexShader(source.getVertexShader());
+	renderer.clearZ();
+}
+
+void OcclusionCuller::drawOccluder(DrawParams& param)
+{
+	// always the full mesh, a simplified lod may lie outside of it
+	auto indId = param.indId;
+	auto lods = std::move(param.lods);
+	if (!lods.empty())
+		param.indId = lods[0].indId;
+	param.lods.clear();
+	renderer.draw(param);
+	param.indId = indId;
+	param.lods = std::move(lods);
+}
+
+bool OcclusionCuller::isVisible(const Aabb& box, const VertexShaderParams& vsp) const
+{
+	int width = renderer.getWidth();
+	int height = renderer.getHeight();
+	float p1 = (vsp.zFar - vsp.zNear) / 2;
+	float p2 = (vsp.zFar + vsp.zNear) / 2;
+	auto mvp = vsp.p * vsp.mv;
+
+	// screen rect and nearest depth of the corners, the same mapping as the rasterizer
+	float xMin = std::numeric_limits<float>::max();
+	float yMin = std::numeric_limits<float>::max();
+	float xMax = std::numeric_limits<float>::lowest();
+	float yMax = std::numeric_limits<float>::lowest();
+	float zMax = std::numeric_limits<float>::lowest();
+	for (int c = 0; c < 8; ++c)
+	{
+		Vector4f corner{ c & 1 ? box.max.x : box.min.x, c & 2 ? box.max.y : box.min.y, c & 4 ? box.max.z : box.min.z, 1.f };
+		auto clip = mvp * corner;
+		// w is the view z, a corner this close to the camera or behind it tells nothing
+		if (clip.w > -vsp.zNear)
+			return true;
+
+		float x = (clip.x / clip.w + 1.f) / 2 * width;
+		float y = (clip.y / clip.w + 1.f) / 2 * height;
+		xMin = std::min(xMin, x);
+		xMax = std::max(xMax, x);
+		yMin = std::min(yMin, y);
+		yMax = std::max(yMax, y);
+		zMax = std::max(zMax, clip.z / clip.w * p1 + p2);
+	}
+
+	// the occluders only cover the pixels whose center they do, one more pixel around the box
+	// keeps their silhouettes from hiding it. off screen is left to frustum culling
+	int x0 = std::max(0, static_cast<int>(std::floor(xMin)) - 1);
+	int y0 = std::max(0, static_cast<int>(std::floor(yMin)) - 1);
+	int x1 = std::min(width - 1, static_cast<int>(std::floor(xMax)) + 1);
+	int y1 = std::min(height - 1, static_cast<int>(std::floor(yMax)) + 1);
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	// larger is closer, hidden only if an occluder is in front of the box at every pixel it touches
+	for (int y = y0; y <= y1; ++y)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			if (renderer.getDepth(x, y) < zMax)
+				return true;
+		}
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef M_OCCLUSION_CULLER_H
+#define M_OCCLUSION_CULLER_H
+
+#include "Math.h"
+#include "Renderer.h"
+#include "DynamicBvh.h"
+
+// low resolution depth of a few large occluders, drawn before the main pass.
+// the depth is conservative, so a box found behind it is hidden at full resolution too.
+class OcclusionCuller
+{
+public:
+	// draws the meshes added to source, at 1 / downscale of its resolution
+	OcclusionCuller(const Renderer& source, int downscale = 4);
+
+	// clears the depth, follows the resolution and picks up the vertex shader of source
+	void begin();
+	// depth-only draw of an occluder whose vsParams are set up for the camera
+	void drawOccluder(DrawParams& param);
+
+	// false if the object-space box is behind the occluders drawn so far, vsp : the camera's, as for the draw
+	bool isVisible(const Aabb& box, const VertexShaderParams& vsp) const;
+
+private:
+	const Renderer& source;
+	Renderer renderer;
+	int downscale;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "PointCloud.h"
+#include <algorithm>
+
+// the 10 bits of v spread to every third bit
+static uint32_t spreadBits(uint32_t v)
+{
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// position along the z-order curve through box, points close on it are close in space
+uint32_t PointCloud::getMortonCode(const Vector3f& p, const Aabb& box)
+{
+	auto quantize = [](float v, float lo, float hi) {
+		float t = hi > lo ? (v - lo) / (hi - lo) : 0.f;
+		return static_cast<uint32_t>(MathUtility::clamp(t, 0.f, 1.f) * 1023.f);
+	};
+	return (spreadBits(quantize(p.x, box.min.x, box.max.x)) << 2) |
+		(spreadBits(quantize(p.y, box.min.y, box.max.y)) << 1) |
+		spreadBits(quantize(p.z, box.min.z, box.max.z));
+}
+
+void PointCloud::build(Renderer& renderer, const std::vector<Vector3f>& positions, const std::vector<Vector4f>& colors)
+{
+	release(renderer);
+	pointCount = positions.size();
+	if (positions.empty())
+		return;
+
+	auto grow = [](Aabb& box, const Vector3f& p) {
+		box.min = Vector3f(std::min(box.min.x, p.x), std::min(box.min.y, p.y), std::min(box.min.z, p.z));
+		box.max = Vector3f(std::max(box.max.x, p.x), std::max(box.max.y, p.y), std::max(box.max.z, p.z));
+	};
+	bounds = Aabb{ positions[0], positions[0] };
+	for (const auto& p : positions)
+		grow(bounds, p);
+
+	// sorted along the z-order curve, consecutive points make compact chunks
+	std::vector<std::pair<uint32_t, int>> order(positions.size());
+	for (int i = 0; i < static_cast<int>(positions.size()); ++i)
+		order[i] = { getMortonCode(positions[i], bounds), i };
+	std::sort(order.begin(), order.end());
+
+	bool hasColors = colors.size() == positions.size();
+	for (size_t first = 0; first < order.size(); first += CHUNK_SIZE)
+	{
+		size_t last = std::min(first + CHUNK_SIZE, order.size());
+		std::vector<Vector3f> chunkPositions;
+		std::vector<Vector4f> chunkColors;
+		chunkPositions.reserve(last - first);
+		if (hasColors)
+			chunkColors.reserve(last - first);
+
+		PointChunk chunk;
+		chunk.bounds = Aabb{ positions[order[first].second], positions[order[first].second] };
+		for (size_t k = first; k < last; ++k)
+		{
+			int i = order[k].second;
+			chunkPositions.push_back(positions[i]);
+			if (hasColors)
+				chunkColors.push_back(colors[i]);
+			grow(chunk.bounds, positions[i]);
+		}
+
+		chunk.posId = renderer.addPositionBuf(std::move(chunkPositions));
+		if (hasColors)
+			chunk.colId = renderer.addColorBuf(std::move(chunkColors));
+		chunks.push_back(chunk);
+	}
+}
+
+void PointCloud::release(Renderer& renderer)
+{
+	for (const auto& chunk : chunks)
+	{
+		renderer.releaseBuf(chunk.posId);
+		renderer.releaseBuf(chunk.colId);
+	}
+	chunks.clear();
+	bounds = Aabb();
+	pointCount = 0;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef M_POINT_CLOUD_H
+#define M_POINT_CLOUD_H
+
+#include "Renderer.h"
+#include "DynamicBvh.h"
+#include <vector>
+
+// nearby points of a cloud, in their own buffers
+struct PointChunk
+{
+	pos_buf_id posId;
+	col_buf_id colId;		// none when the cloud has no colors
+	Aabb bounds;			// object space
+};
+
+// a scan too big to draw as one buffer: the points are cut into chunks of neighbours so a draw
+// skips the chunks outside the frustum (see Renderer::drawPointCloud)
+class PointCloud
+{
+public:
+	static const int CHUNK_SIZE = 16384;
+
+	// colors : [0, 1] per point, or empty. the buffers of the chunks go into the renderer's store
+	void build(Renderer& renderer, const std::vector<Vector3f>& positions, const std::vector<Vector4f>& colors);
+	void release(Renderer& renderer);
+
+	const std::vector<PointChunk>& getChunks() const { return chunks; };
+	const Aabb& getBounds() const { return bounds; };
+	size_t getPointCount() const { return pointCount; };
+
+private:
+	std::vector<PointChunk> chunks;
+	Aabb bounds;
+	size_t pointCount = 0;
+
+	static uint32_t getMortonCode(const Vector3f& p, const Aabb& box);
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,313 @@
+#include "PostChain.h"
+#include <algorithm>
+#include <cmath>
+
+// [0, 1] into a 32 bit pixel, what SDL_MapRGB does without the call
+Uint32 PostChain::packColor(const SDL_PixelFormat* format, float r, float g, float b)
+{
+	auto channel = [](float v, Uint8 loss, Uint8 shift) {
+		return (static_cast<Uint32>(v * 255.f + 0.5f) >> loss) << shift;
+	};
+	return channel(r, format->Rloss, format->Rshift) | channel(g, format->Gloss, format->Gshift) | channel(b, format->Bloss, format->Bshift) | format->Amask;
+}
+
+void PostChain::run(const HdrImage& src, Texture& target)
+{
+	if (src.width <= 0 || src.height <= 0)
+		return;
+
+	if (settings.bloom)
+	{
+		brightPass(src);
+		blur();
+	}
+	toneMap(src, target);
+	if (settings.fxaa)
+		fxaa(target);
+}
+
+// 2x2 average down to half resolution, fused with the threshold
+void PostChain::brightPass(const HdrImage& src)
+{
+	bloomA.resize((src.width + 1) / 2, (src.height + 1) / 2);
+	bloomB.resize(bloomA.width, bloomA.height);
+
+	float threshold = settings.bloomThreshold;
+	auto pass = [&](int y0, int y1) {
+		int w = bloomA.width;
+		for (int y = y0; y < y1; ++y)
+		{
+			int sy0 = 2 * y;
+			int sy1 = std::min(sy0 + 1, src.height - 1);
+			for (int c = 0; c < 3; ++c)
+			{
+				const float* row0 = src.row(c, sy0);
+				const float* row1 = src.row(c, sy1);
+				float* out = bloomA.row(c, y);
+				for (int x = 0; x < w; ++x)
+				{
+					int sx0 = 2 * x;
+					int sx1 = std::min(sx0 + 1, src.width - 1);
+					out[x] = 0.25f * (row0[sx0] + row0[sx1] + row1[sx0] + row1[sx1]);
+				}
+			}
+
+			// keep the part of the color above the threshold, with its hue
+			float* r = bloomA.row(0, y);
+			float* g = bloomA.row(1, y);
+			float* b = bloomA.row(2, y);
+			for (int x = 0; x < w; ++x)
+			{
+				float lum = 0.2126f * r[x] + 0.7152f * g[x] + 0.0722f * b[x];
+				float k = std::max(lum - threshold, 0.f) / std::max(lum, 1e-4f);
+				r[x] *= k;
+				g[x] *= k;
+				b[x] *= k;
+			}
+		}
+	};
+	parallelRows(bloomA.height, pass);
+}
+
+// separable gaussian, rows from bloomA into bloomB then columns back into bloomA
+void PostChain::blur()
+{
+	kernelRadius = MathUtility::clamp(settings.bloomRadius, 1, MAX_BLUR_RADIUS);
+	float sigma = kernelRadius / 2.f;
+	float sum = 0.f;
+	for (int k = -kernelRadius; k <= kernelRadius; ++k)
+	{
+		kernel[k + kernelRadius] = std::exp(-k * k / (2.f * sigma * sigma));
+		sum += kernel[k + kernelRadius];
+	}
+	for (int k = 0; k <= 2 * kernelRadius; ++k)
+		kernel[k] /= sum;
+
+	int w = bloomA.width;
+	int h = bloomA.height;
+	int r = kernelRadius;
+
+	auto horizontal = [&](int y0, int y1) {
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				const float* in = bloomA.row(c, y);
+				float* out = bloomB.row(c, y);
+				std::fill(out, out + w, 0.f);
+				for (int k = -r; k <= r; ++k)
+				{
+					// x + k inside the row, the edge pixel repeats outside
+					float wk = kernel[k + r];
+					int lo = std::min(std::max(0, -k), w);
+					int hi = std::max(std::min(w, w - k), lo);
+					for (int x = 0; x < lo; ++x)
+						out[x] += wk * in[0];
+					for (int x = lo; x < hi; ++x)
+						out[x] += wk * in[x + k];
+					for (int x = hi; x < w; ++x)
+						out[x] += wk * in[w - 1];
+				}
+			}
+		}
+	};
+	parallelRows(h, horizontal);
+
+	auto vertical = [&](int y0, int y1) {
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				float* out = bloomA.row(c, y);
+				std::fill(out, out + w, 0.f);
+				for (int k = -r; k <= r; ++k)
+				{
+					float wk = kernel[k + r];
+					const float* in = bloomB.row(c, MathUtility::clamp(y + k, 0, h - 1));
+					for (int x = 0; x < w; ++x)
+						out[x] += wk * in[x];
+				}
+			}
+		}
+	};
+	parallelRows(h, vertical);
+}
+
+// hdr + bloom, exposure and the aces curve into ldr, fused with writing the target when fxaa is off
+void PostChain::toneMap(const HdrImage& src, Texture& target)
+{
+	int w = src.width;
+	int h = src.height;
+	ldr.resize(w, h);
+	if (settings.fxaa)
+		luma.resize(static_cast<size_t>(w) * h);
+
+	SDL_Surface* surface = target.getRawSurface();
+	// a copy, the stores into the pixels would otherwise reload it for every pixel
+	SDL_PixelFormat format = *surface->format;
+	bool bloom = settings.bloom;
+	float strength = settings.bloomStrength;
+	float exposure = settings.exposure;
+
+	auto pass = [&](int y0, int y1) {
+		int bw = bloomA.width;
+		int bh = bloomA.height;
+		for (int y = y0; y < y1; ++y)
+		{
+			// bilinear from the half resolution bloom, its pixel centers are at (x + 0.5) / 2 - 0.5: an even
+			// x takes 3/4 of bloom column x / 2 and 1/4 of the one before it, an odd x 1/4 of the one after
+			int byi = (y - 1) >> 1;
+			float fy = y & 1 ? 0.25f : 0.75f;
+
+			for (int c = 0; c < 3; ++c)
+			{
+				const float* in = src.row(c, y);
+				float* out = ldr.row(c, y);
+				if (bloom)
+				{
+					const float* r0 = bloomA.row(c, MathUtility::clamp(byi, 0, bh - 1));
+					const float* r1 = bloomA.row(c, MathUtility::clamp(byi + 1, 0, bh - 1));
+					// sliding over the columns lerped between the two rows
+					float prev = r0[0] + fy * (r1[0] - r0[0]);
+					float cur = prev;
+					for (int i = 0; i < bw; ++i)
+					{
+						int n = std::min(i + 1, bw - 1);
+						float next = r0[n] + fy * (r1[n] - r0[n]);
+						out[2 * i] = in[2 * i] + strength * (0.75f * cur + 0.25f * prev);
+						if (2 * i + 1 < w)
+							out[2 * i + 1] = in[2 * i + 1] + strength * (0.75f * cur + 0.25f * next);
+						prev = cur;
+						cur = next;
+					}
+				}
+				else
+				{
+					std::copy(in, in + w, out);
+				}
+
+				// narkowicz's fit of the aces filmic curve
+				for (int x = 0; x < w; ++x)
+				{
+					float v = out[x] * exposure;
+					v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+					out[x] = std::min(std::max(v, 0.f), 1.f);
+				}
+			}
+
+			const float* r = ldr.row(0, y);
+			const float* g = ldr.row(1, y);
+			const float* b = ldr.row(2, y);
+			if (settings.fxaa)
+			{
+				float* l = &luma[static_cast<size_t>(y) * w];
+				for (int x = 0; x < w; ++x)
+					l[x] = 0.299f * r[x] + 0.587f * g[x] + 0.114f * b[x];
+			}
+			else
+			{
+				Uint32* dst = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + (h - 1 - y) * surface->pitch);
+				for (int x = 0; x < w; ++x)
+					dst[x] = packColor(&format, r[x], g[x], b[x]);
+			}
+		}
+	};
+	parallelRows(h, pass);
+}
+
+// fxaa as in lottes' original: blend along the edge direction given by the luma of the diagonals,
+// fall back to the narrower blend when the wider one picks up a color outside the neighbourhood
+void PostChain::fxaa(Texture& target)
+{
+	const float REDUCE_MIN = 1.f / 128.f;
+	const float REDUCE_MUL = 1.f / 8.f;
+	const float SPAN_MAX = 8.f;
+	const float EDGE_THRESHOLD = 1.f / 8.f;
+	const float EDGE_THRESHOLD_MIN = 1.f / 32.f;
+
+	int w = ldr.width;
+	int h = ldr.height;
+	SDL_Surface* surface = target.getRawSurface();
+	// a copy, the stores into the pixels would otherwise reload it for every pixel
+	SDL_PixelFormat format = *surface->format;
+
+	// bilinear, pixel centers at integer coordinates
+	auto sample = [&](float x, float y, float rgb[3]) {
+		x = MathUtility::clamp(x, 0.f, static_cast<float>(w - 1));
+		y = MathUtility::clamp(y, 0.f, static_cast<float>(h - 1));
+		int x0 = static_cast<int>(x);
+		int y0 = static_cast<int>(y);
+		int x1 = std::min(x0 + 1, w - 1);
+		int y1 = std::min(y0 + 1, h - 1);
+		float fx = x - x0;
+		float fy = y - y0;
+		for (int c = 0; c < 3; ++c)
+		{
+			const float* r0 = ldr.row(c, y0);
+			const float* r1 = ldr.row(c, y1);
+			float a = r0[x0] + fx * (r0[x1] - r0[x0]);
+			float b = r1[x0] + fx * (r1[x1] - r1[x0]);
+			rgb[c] = a + fy * (b - a);
+		}
+	};
+
+	auto pass = [&](int y0, int y1) {
+		for (int y = y0; y < y1; ++y)
+		{
+			Uint32* dst = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + (h - 1 - y) * surface->pitch);
+			// the edge pixels repeat outside the image
+			const float* above = &luma[static_cast<size_t>(std::max(y - 1, 0)) * w];
+			const float* middle = &luma[static_cast<size_t>(y) * w];
+			const float* below = &luma[static_cast<size_t>(std::min(y + 1, h - 1)) * w];
+			for (int x = 0; x < w; ++x)
+			{
+				int left = std::max(x - 1, 0);
+				int right = std::min(x + 1, w - 1);
+				float lM = middle[x];
+				float lNW = above[left];
+				float lNE = above[right];
+				float lSW = below[left];
+				float lSE = below[right];
+				float lumaMin = std::min({ lM, lNW, lNE, lSW, lSE });
+				float lumaMax = std::max({ lM, lNW, lNE, lSW, lSE });
+
+				float rgb[3];
+				if (lumaMax - lumaMin < std::max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD))
+				{
+					// no edge, most of the pixels
+					for (int c = 0; c < 3; ++c)
+						rgb[c] = ldr.row(c, y)[x];
+				}
+				else
+				{
+					// along the edge, across the luma gradient
+					float dirX = -((lNW + lNE) - (lSW + lSE));
+					float dirY = (lNW + lSW) - (lNE + lSE);
+					float dirReduce = std::max((lNW + lNE + lSW + lSE) * (0.25f * REDUCE_MUL), REDUCE_MIN);
+					float rcpDirMin = 1.f / (std::min(std::abs(dirX), std::abs(dirY)) + dirReduce);
+					dirX = MathUtility::clamp(dirX * rcpDirMin, -SPAN_MAX, SPAN_MAX);
+					dirY = MathUtility::clamp(dirY * rcpDirMin, -SPAN_MAX, SPAN_MAX);
+
+					float a0[3], a1[3], b0[3], b1[3];
+					sample(x + dirX * (1.f / 3.f - 0.5f), y + dirY * (1.f / 3.f - 0.5f), a0);
+					sample(x + dirX * (2.f / 3.f - 0.5f), y + dirY * (2.f / 3.f - 0.5f), a1);
+					sample(x - dirX * 0.5f, y - dirY * 0.5f, b0);
+					sample(x + dirX * 0.5f, y + dirY * 0.5f, b1);
+
+					float rgbA[3], rgbB[3];
+					for (int c = 0; c < 3; ++c)
+					{
+						rgbA[c] = 0.5f * (a0[c] + a1[c]);
+						rgbB[c] = 0.5f * rgbA[c] + 0.25f * (b0[c] + b1[c]);
+					}
+					float lumaB = 0.299f * rgbB[0] + 0.587f * rgbB[1] + 0.114f * rgbB[2];
+					const float* pick = lumaB < lumaMin || lumaB > lumaMax ? rgbA : rgbB;
+					std::copy(pick, pick + 3, rgb);
+				}
+
+				dst[x] = packColor(&format, rgb[0], rgb[1], rgb[2]);
+			}
+		}
+	};
+	parallelRows(h, pass);
+}
\ No newline at end of file
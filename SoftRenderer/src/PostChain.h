@@ -0,0 +1,66 @@
+#ifndef M_POST_CHAIN_H
+#define M_POST_CHAIN_H
+
+#include "HdrImage.h"
+#include "Texture.h"
+#include "WorkerPool.h"
+#include <vector>
+#include <memory>
+
+// turns an hdr frame into the 8-bit target: bloom, tone mapping and fxaa.
+// every pass splits the rows between the workers and the calling thread, the inner loops run along
+// the planes of a row so the compiler vectorizes them. passes that read only their own pixel are fused
+// into the next one, the intermediate images are kept from frame to frame.
+class PostChain
+{
+public:
+	struct Settings
+	{
+		float exposure = 1.f;
+		bool bloom = true;
+		float bloomThreshold = 1.f;		// luminance above it spreads
+		float bloomStrength = 0.15f;
+		int bloomRadius = 6;			// of the gaussian at half resolution, up to MAX_BLUR_RADIUS
+		bool fxaa = true;
+	};
+
+	// pool : splits the passes, nullptr to run them on the calling thread
+	explicit PostChain(std::shared_ptr<WorkerPool> pool) : pool(std::move(pool)) {};
+
+	// src into the top-left src.width x src.height of target
+	void run(const HdrImage& src, Texture& target);
+
+	Settings settings;
+
+	static const int MAX_BLUR_RADIUS = 16;
+
+private:
+	// calls func(y0, y1) on bands of [0, rows)
+	template<typename Func>
+	void parallelRows(int rows, Func& func)
+	{
+		if (pool)
+			pool->parallelFor(rows, func);
+		else if (rows > 0)
+			func(0, rows);
+	};
+
+	void brightPass(const HdrImage& src);
+	void blur();
+	void toneMap(const HdrImage& src, Texture& target);
+	void fxaa(Texture& target);
+	static Uint32 packColor(const SDL_PixelFormat* format, float r, float g, float b);
+
+	// half resolution bloom, ping-ponged between the separable passes
+	HdrImage bloomA;
+	HdrImage bloomB;
+	// tone mapped [0, 1] color and its luma for fxaa
+	HdrImage ldr;
+	std::vector<float> luma;
+	float kernel[2 * MAX_BLUR_RADIUS + 1];		// centered on kernel[kernelRadius]
+	int kernelRadius = 0;
+
+	std::shared_ptr<WorkerPool> pool;
+};
+
+#endif
\ No newline at end of file
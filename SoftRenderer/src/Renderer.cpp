@@ -1,66 +1,867 @@
 #include "Renderer.h"
+#include "FrameArena.h"
+#include "PointCloud.h"
+#include "Material.h"
+#include <limits>
+#include <cmath>
+#include <algorithm>
 
-Renderer::Renderer(SDL_Surface* src) : renderTexture(src), zBuf(src->w * src->h, 0.f)
+Renderer::Renderer(SDL_Surface* src) : renderTexture(src), buffers(std::make_shared<BufferStore>()), width(src->w), height(src->h)
 {
+	lightTileCols = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	lightTileRows = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	setSampleCount(1);
+}
+
+Renderer::Renderer(int w, int h) : buffers(std::make_shared<BufferStore>()), width(w), height(h)
+{
+	lightTileCols = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	lightTileRows = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	setSampleCount(1);
+}
+
+void Renderer::setSampleCount(int samples)
+{
+	// standard rotated-grid patterns, in 1/16 pixel from the pixel center
+	static const int pattern4[] = { -2, -6, 6, -2, -6, 2, 2, 6 };
+	static const int pattern8[] = { 1, -3, -1, 3, 5, 1, -3, -5, -5, 5, -7, -1, 3, 7, 7, -7 };
+
+	sampleOffsets.clear();
+	if (samples >= 8)
+	{
+		for (int s = 0; s < 8; ++s)
+			sampleOffsets.push_back(Vector2f{ 0.5f + pattern8[s * 2] / 16.f, 0.5f + pattern8[s * 2 + 1] / 16.f });
+	}
+	else if (samples >= 4)
+	{
+		for (int s = 0; s < 4; ++s)
+			sampleOffsets.push_back(Vector2f{ 0.5f + pattern4[s * 2] / 16.f, 0.5f + pattern4[s * 2 + 1] / 16.f });
+	}
+	else
+	{
+		sampleOffsets.push_back(Vector2f{ 0.5f, 0.5f });
+	}
+
+	sampleCount = static_cast<int>(sampleOffsets.size());
+	depthBuffer.allocate(width, height, sampleCount, depthBuffer.getFormat());
+	int tileCount = ((width + DepthBuffer::TILE_SIZE - 1) / DepthBuffer::TILE_SIZE) * ((height + DepthBuffer::TILE_SIZE - 1) / DepthBuffer::TILE_SIZE);
+	if (sampleCount > 1)
+	{
+		sampleColors.assign(width * height * sampleCount, 0);
+		colorTileCleared.assign(tileCount, 0);
+	}
+	else
+	{
+		sampleColors.clear();
+		colorTileCleared.clear();
+	}
+	clearSampleColor = 0;
+
+	if (hdr)
+		hdrTarget.resize(width, height);
+}
+
+void Renderer::setHdr(bool enable)
+{
+	hdr = enable;
+	if (!hdr)
+		hdrTarget = HdrImage();
+	// the samples are packed differently
+	setSampleCount(sampleCount);
+}
+
+void Renderer::setDepthFormat(DepthFormat format)
+{
+	depthBuffer.allocate(width, height, sampleCount, format);
+}
+
+void Renderer::setResolution(int w, int h)
+{
+	if (w == width && h == height)
+		return;
 
+	width = w;
+	height = h;
+	lightTileCols = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	lightTileRows = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	lightTileOffsets.clear();		// the tile grid changed, rebuild on the next draw
+	tileShadingRates.clear();
+	hasScissor = false;
+	setSampleCount(sampleCount);
 }
 
 void Renderer::clearColor(const Vector4f &col)
 {
-	renderTexture.clear(col);
+	auto area = getDrawArea();
+	if (area.empty())
+		return;
+
+	if (sampleCount == 1 && hdr)
+	{
+		hdrTarget.fill(std::max(col.x, 0.f) / 255.f, std::max(col.y, 0.f) / 255.f, std::max(col.z, 0.f) / 255.f, area.x0, area.y0, area.x1, area.y1);
+		return;
+	}
+	if (sampleCount == 1)
+	{
+		if (hasScissor)	// the texture is addressed from the left-top
+			renderTexture.clear(col, area.x0, height - 1 - area.y1, area.x1 - area.x0 + 1, area.y1 - area.y0 + 1);
+		else
+			renderTexture.clear(col);
+		return;
+	}
+
+	// the flagged tiles outside the rect keep the old clear color
+	auto packed = packSample(col);
+	if (packed != clearSampleColor)
+	{
+		for (int tile = 0; tile < static_cast<int>(colorTileCleared.size()); ++tile)
+		{
+			if (colorTileCleared[tile])
+				fillColorTile(tile);
+		}
+		clearSampleColor = packed;
+	}
+
+	const int size = DepthBuffer::TILE_SIZE;
+	int tileCols = (width + size - 1) / size;
+	for (int ty = area.y0 / size; ty <= area.y1 / size; ++ty)
+	{
+		for (int tx = area.x0 / size; tx <= area.x1 / size; ++tx)
+		{
+			int tile = ty * tileCols + tx;
+			int x0 = tx * size;
+			int y0 = ty * size;
+			if (x0 >= area.x0 && y0 >= area.y0 && std::min(x0 + size, width) - 1 <= area.x1 && std::min(y0 + size, height) - 1 <= area.y1)
+			{
+				colorTileCleared[tile] = 1;
+				continue;
+			}
+
+			// across the edge of the scissor, only the pixels inside
+			if (colorTileCleared[tile])
+				continue;
+			for (int y = std::max(y0, area.y0); y <= std::min(y0 + size - 1, area.y1); ++y)
+			{
+				int xBegin = std::max(x0, area.x0);
+				int xEnd = std::min(x0 + size - 1, area.x1);
+				std::fill_n(&sampleColors[getIndex(xBegin, y) * sampleCount], (xEnd - xBegin + 1) * sampleCount, packed);
+			}
+		}
+	}
+}
+
+// writes the clear color into a flagged tile of sampleColors
+void Renderer::fillColorTile(int tile)
+{
+	const int size = DepthBuffer::TILE_SIZE;
+	int tileCols = (width + size - 1) / size;
+	int x0 = (tile % tileCols) * size;
+	int y0 = (tile / tileCols) * size;
+	int w = std::min(x0 + size, width) - x0;
+	for (int y = y0; y < std::min(y0 + size, height); ++y)
+		std::fill_n(&sampleColors[getIndex(x0, y) * sampleCount], w * sampleCount, clearSampleColor);
+	colorTileCleared[tile] = 0;
+}
+
+Uint32* Renderer::getSampleColors(int x, int y)
+{
+	const int size = DepthBuffer::TILE_SIZE;
+	int tile = (y / size) * ((width + size - 1) / size) + x / size;
+	if (colorTileCleared[tile])
+		fillColorTile(tile);
+	return &sampleColors[getIndex(x, y) * sampleCount];
+}
+
+Uint32 Renderer::packColor(const Vector4f& col)
+{
+	auto r = static_cast<Uint32>(MathUtility::clamp(col.x, 0.f, 255.f));
+	auto g = static_cast<Uint32>(MathUtility::clamp(col.y, 0.f, 255.f));
+	auto b = static_cast<Uint32>(MathUtility::clamp(col.z, 0.f, 255.f));
+	auto a = static_cast<Uint32>(MathUtility::clamp(col.w, 0.f, 255.f));
+	return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+Uint32 Renderer::packSample(const Vector4f& col) const
+{
+	if (hdr)
+		return packRgb9e5(col.x / 255.f, col.y / 255.f, col.z / 255.f);
+	return packColor(col);
+}
+
+// 9 bits of mantissa per channel and a shared 5 bit exponent, from 2^-24 up to 65408
+Uint32 Renderer::packRgb9e5(float r, float g, float b)
+{
+	const float maxValue = 65408.f;
+	r = MathUtility::clamp(r, 0.f, maxValue);
+	g = MathUtility::clamp(g, 0.f, maxValue);
+	b = MathUtility::clamp(b, 0.f, maxValue);
+	float m = std::max({ r, g, b });
+	if (m < std::ldexp(1.f, -24))
+		return 0;
+
+	// m < 2^e, the channels are multiples of 2^(e - 9)
+	int e;
+	std::frexp(m, &e);
+	e = std::max(e, -14);
+	float scale = std::ldexp(1.f, 9 - e);
+	if (static_cast<Uint32>(m * scale + 0.5f) > 511)
+	{
+		++e;
+		scale *= 0.5f;
+	}
+
+	auto rm = static_cast<Uint32>(r * scale + 0.5f);
+	auto gm = static_cast<Uint32>(g * scale + 0.5f);
+	auto bm = static_cast<Uint32>(b * scale + 0.5f);
+	return (static_cast<Uint32>(e + 15) << 27) | (bm << 18) | (gm << 9) | rm;
+}
+
+void Renderer::unpackRgb9e5(Uint32 packed, float rgb[3])
+{
+	float scale = std::ldexp(1.f, static_cast<int>(packed >> 27) - 15 - 9);
+	rgb[0] = (packed & 0x1ff) * scale;
+	rgb[1] = ((packed >> 9) & 0x1ff) * scale;
+	rgb[2] = ((packed >> 18) & 0x1ff) * scale;
+}
+
+// from left-bottom, col goes to every sample in mask
+void Renderer::writeSamples(int x, int y, unsigned int mask, const Vector4f& col)
+{
+	if (sampleCount == 1)
+	{
+		if (hdr)
+		{
+			int idx = getIndex(x, y);
+			hdrTarget.planes[0][idx] = std::max(col.x, 0.f) / 255.f;
+			hdrTarget.planes[1][idx] = std::max(col.y, 0.f) / 255.f;
+			hdrTarget.planes[2][idx] = std::max(col.z, 0.f) / 255.f;
+		}
+		else
+		{
+			setColor(x, y, col);
+		}
+		return;
+	}
+
+	auto packed = packSample(col);
+	Uint32* samples = getSampleColors(x, y);
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		if (mask & (1u << s))
+			samples[s] = packed;
+	}
+}
+
+// average the samples of every pixel into renderTexture, or hdrTarget
+void Renderer::resolve()
+{
+	if (sampleCount == 1)
+		return;
+
+	// a tile still flagged as cleared resolves to the clear color without reading its samples
+	const int size = DepthBuffer::TILE_SIZE;
+	int tileCols = (width + size - 1) / size;
+	Vector4f clearCol{
+		static_cast<float>((clearSampleColor >> 16) & 0xff),
+		static_cast<float>((clearSampleColor >> 8) & 0xff),
+		static_cast<float>(clearSampleColor & 0xff),
+		static_cast<float>(clearSampleColor >> 24)
+	};
+	float clearHdr[3];
+	unpackRgb9e5(clearSampleColor, clearHdr);
+
+	auto area = getDrawArea();
+	float inv = 1.f / sampleCount;
+	for (int y = area.y0; y <= area.y1; ++y)
+	{
+		for (int x = area.x0; x <= area.x1; ++x)
+		{
+			bool cleared = colorTileCleared[(y / size) * tileCols + x / size];
+			const Uint32* samples = &sampleColors[getIndex(x, y) * sampleCount];
+
+			if (hdr)
+			{
+				float sum[3] = { 0.f, 0.f, 0.f };
+				if (cleared)
+				{
+					std::copy(clearHdr, clearHdr + 3, sum);
+				}
+				else
+				{
+					for (int s = 0; s < sampleCount; ++s)
+					{
+						float rgb[3];
+						unpackRgb9e5(samples[s], rgb);
+						for (int c = 0; c < 3; ++c)
+							sum[c] += rgb[c] * inv;
+					}
+				}
+				for (int c = 0; c < 3; ++c)
+					hdrTarget.planes[c][getIndex(x, y)] = sum[c];
+				continue;
+			}
+
+			if (cleared)
+			{
+				setColor(x, y, clearCol);
+				continue;
+			}
+
+			Uint32 sum[4] = { 0, 0, 0, 0 };
+			for (int s = 0; s < sampleCount; ++s)
+			{
+				sum[0] += (samples[s] >> 16) & 0xff;
+				sum[1] += (samples[s] >> 8) & 0xff;
+				sum[2] += samples[s] & 0xff;
+				sum[3] += samples[s] >> 24;
+			}
+
+			setColor(x, y, Vector4f{ sum[0] * inv, sum[1] * inv, sum[2] * inv, sum[3] * inv });
+		}
+	}
 }
+
 void Renderer::clearZ()
 {
-	std::fill(zBuf.begin(), zBuf.end(), 0.f);
+	if (!hasScissor)
+		depthBuffer.clear();
+	else if (!scissor.empty())
+		depthBuffer.clear(scissor.x0, scissor.y0, scissor.x1, scissor.y1);
+}
+
+void Renderer::setScissor(const ScreenRect& rect)
+{
+	ScreenRect screen;
+	screen.x1 = width - 1;
+	screen.y1 = height - 1;
+	scissor = ScreenRect::intersect(rect, screen);
+	hasScissor = true;
+}
+
+ScreenRect Renderer::getDrawArea() const
+{
+	if (hasScissor)
+		return scissor;
+
+	ScreenRect screen;
+	screen.x1 = width - 1;
+	screen.y1 = height - 1;
+	return screen;
+}
+
+// true if the bounding sphere of the draw misses the scissor rect
+bool Renderer::isOutsideScissor(const DrawParams& param)
+{
+	if (!hasScissor || param.boundRadius <= 0.f)
+		return false;
+	if (scissor.empty())
+		return true;
+
+	const auto& mv = param.vsParams.mv;
+	auto center = mv * Vector4f{ param.boundCenter.x, param.boundCenter.y, param.boundCenter.z, 1.f };
+	float scale = 0.f;
+	for (int c = 0; c < 3; ++c)
+	{
+		Vector3f axis{ mv.num[c], mv.num[4 + c], mv.num[8 + c] };
+		scale = std::max(scale, axis.length());
+	}
+
+	float rect[4];
+	if (!getSphereScreenRect(static_cast<Vector3f>(center), param.boundRadius * scale, param.vsParams.p, param.vsParams.zNear, rect))
+		return true;
+	return rect[2] < scissor.x0 || rect[0] >= scissor.x1 + 1 || rect[3] < scissor.y0 || rect[1] >= scissor.y1 + 1;
 }
 
 void Renderer::draw(DrawParams &param)
 {
+	if (isOutsideScissor(param))
+		return;
+
+	if (!param.lods.empty())
+		param.indId = param.lods[selectLod(param)].indId;
+
 	if (param.type == Primitive::Point)
 		drawPoint(param);
+	else if (renderPass == RenderPass::DepthOnly)
+		drawTriangleDepth(param);
 	else
 		drawTriangle(param);
 }
 
-void Renderer::drawPoint(DrawParams param)
+// pick the coarsest lod whose error, projected on screen, is still under the threshold
+int Renderer::selectLod(const DrawParams& param)
 {
-	VertexShaderParams& vsp = param.vsParams;
-	auto posbuf = posBufs.at(param.posId.id);
-	auto& boneWeightBuf = boneWeightBufs.at(param.boneWeightId.id);
+	const auto& mv = param.vsParams.mv;
+	const auto& p = param.vsParams.p;
 
-	for (int i = 0; i < posbuf.size(); ++i)
+	auto center = mv * Vector4f{ param.boundCenter.x, param.boundCenter.y, param.boundCenter.z, 1.f };
+	float scale = 0.f;
+	for (int c = 0; c < 3; ++c)
 	{
-		vsp.pos = static_cast<Vector4f>(posbuf[i]);
-		vsp.pos.w = 1;
+		Vector3f axis{ mv.num[c], mv.num[4 + c], mv.num[8 + c] };
+		scale = std::max(scale, axis.length());
+	}
 
-		vsp.allBonesTransform = Matrix4f::Identity();
-		if (boneWeightBuf.size() > 0)
+	// camera faces -z
+	float dist = -center.z - param.boundRadius * scale;
+	if (dist <= param.vsParams.zNear)
+		return 0;
+
+	float pixelsPerUnit = 0.5f * height * std::abs(p.num[5]) / dist;
+
+	int lod = 0;
+	for (int i = 1; i < static_cast<int>(param.lods.size()); ++i)
+	{
+		if (param.lods[i].error * scale * pixelsPerUnit > lodErrorThreshold)
+			break;
+		lod = i;
+	}
+	return lod;
+}
+
+// screen-space bounds {xMin, yMin, xMax, yMax} of a view-space light sphere, false if it can't be seen
+bool Renderer::getSphereScreenRect(const Vector3f& c, float r, const Matrix4f& projection, float zNear, float rect[4])
+{
+	// entirely behind the near plane
+	if (c.z - r > -zNear)
+		return false;
+
+	// crossing the near plane, the projection is unbounded
+	if (c.z + r > -zNear)
+	{
+		rect[0] = 0.f;
+		rect[1] = 0.f;
+		rect[2] = static_cast<float>(width);
+		rect[3] = static_cast<float>(height);
+		return true;
+	}
+
+	// the projected corners of the bounding box enclose the projected sphere
+	rect[0] = rect[1] = std::numeric_limits<float>::max();
+	rect[2] = rect[3] = std::numeric_limits<float>::lowest();
+	for (int k = 0; k < 8; ++k)
+	{
+		Vector4f corner{
+			c.x + ((k & 1) ? r : -r),
+			c.y + ((k & 2) ? r : -r),
+			c.z + ((k & 4) ? r : -r),
+			1.f
+		};
+		auto clip = projection * corner;
+		float x = (clip.x / clip.w + 1.f) / 2 * width;
+		float y = (clip.y / clip.w + 1.f) / 2 * height;
+		rect[0] = std::min(rect[0], x);
+		rect[1] = std::min(rect[1], y);
+		rect[2] = std::max(rect[2], x);
+		rect[3] = std::max(rect[3], y);
+	}
+
+	return rect[2] >= 0.f && rect[3] >= 0.f && rect[0] < width && rect[1] < height;
+}
+
+// bin the lights into screen tiles, skipped when neither the lights nor the projection changed
+void Renderer::updateLightTiles(const std::vector<Light>& lights, const Matrix4f& projection, float zNear)
+{
+	bool same = !lightTileOffsets.empty() && lights.size() == tiledLights.size() &&
+		std::equal(std::begin(projection.num), std::end(projection.num), std::begin(tiledProjection.num));
+	for (int i = 0; same && i < static_cast<int>(lights.size()); ++i)
+	{
+		const auto& a = lights[i];
+		const auto& b = tiledLights[i];
+		same = a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z && a.radius == b.radius;
+	}
+	if (same)
+		return;
+
+	tiledLights = lights;
+	tiledProjection = projection;
+
+	int tileCount = lightTileCols * lightTileRows;
+	FrameVector<int> tileRects(lights.size() * 4, -1);
+	lightTileOffsets.assign(tileCount + 1, 0);
+
+	for (int i = 0; i < static_cast<int>(lights.size()); ++i)
+	{
+		float rect[4];
+		if (!getSphereScreenRect(lights[i].position, lights[i].radius, projection, zNear, rect))
+			continue;
+
+		int* tr = &tileRects[i * 4];
+		tr[0] = MathUtility::clamp(static_cast<int>(rect[0]) / LIGHT_TILE_SIZE, 0, lightTileCols - 1);
+		tr[1] = MathUtility::clamp(static_cast<int>(rect[1]) / LIGHT_TILE_SIZE, 0, lightTileRows - 1);
+		tr[2] = MathUtility::clamp(static_cast<int>(rect[2]) / LIGHT_TILE_SIZE, 0, lightTileCols - 1);
+		tr[3] = MathUtility::clamp(static_cast<int>(rect[3]) / LIGHT_TILE_SIZE, 0, lightTileRows - 1);
+		for (int ty = tr[1]; ty <= tr[3]; ++ty)
+			for (int tx = tr[0]; tx <= tr[2]; ++tx)
+				++lightTileOffsets[ty * lightTileCols + tx + 1];
+	}
+
+	for (int t = 0; t < tileCount; ++t)
+		lightTileOffsets[t + 1] += lightTileOffsets[t];
+
+	lightTileIndices.resize(lightTileOffsets[tileCount]);
+	FrameVector<int> cursor(lightTileOffsets.begin(), lightTileOffsets.end() - 1);
+	for (int i = 0; i < static_cast<int>(lights.size()); ++i)
+	{
+		const int* tr = &tileRects[i * 4];
+		if (tr[0] < 0)
+			continue;
+		for (int ty = tr[1]; ty <= tr[3]; ++ty)
+			for (int tx = tr[0]; tx <= tr[2]; ++tx)
+				lightTileIndices[cursor[ty * lightTileCols + tx]++] = i;
+	}
+}
+
+// the vertices of the draw as points, projected by mv and p without the vertex shader
+void Renderer::drawPoint(DrawParams& param)
+{
+	auto vtxbuf = buffers->vertexBufs.get(param.vtxId);
+	auto posbuf = buffers->posBufs.get(param.posId);
+	auto colbuf = buffers->colorBufs.get(param.colId);
+	if (vtxbuf != nullptr && vtxbuf->layout.positionOffset < 0)
+		vtxbuf = nullptr;
+
+	PointSource source;
+	if (vtxbuf != nullptr && vtxbuf->layout.positionFormat == PositionFormat::Float3)
+	{
+		source.positions = &vtxbuf->data[vtxbuf->layout.positionOffset];
+		source.stride = vtxbuf->layout.stride;
+		source.count = vtxbuf->size();
+	}
+	else if (vtxbuf != nullptr)
+	{
+		// the point jobs read floats, compact positions are unpacked once per draw
+		int count = vtxbuf->size();
+		pointPositions.resize(static_cast<size_t>(count) * 3);
+		for (int i = 0; i < count; ++i)
 		{
-			// calculate allBoneTransform
-			Matrix4f transform = Matrix4f::Zero();
-			auto& posBoneWeights = boneWeightBuf[i];
-			for (const auto& pairW : posBoneWeights)
+			auto p = VertexFormat::fetchPosition(&vtxbuf->data[static_cast<size_t>(i) * vtxbuf->layout.stride], vtxbuf->layout);
+			pointPositions[i * 3] = p.x;
+			pointPositions[i * 3 + 1] = p.y;
+			pointPositions[i * 3 + 2] = p.z;
+		}
+		source.positions = pointPositions.data();
+		source.count = count;
+	}
+	else if (posbuf != nullptr && !posbuf->empty())
+	{
+		source.positions = &(*posbuf)[0].x;
+		source.count = static_cast<int>(posbuf->size());
+	}
+	else
+	{
+		return;
+	}
+	if (colbuf != nullptr && static_cast<int>(colbuf->size()) >= source.count)
+		source.colors = colbuf->data();
+	source.boneWeights = buffers->boneWeightBufs.get(param.boneWeightId);
+
+	pointSources.clear();
+	pointSources.push_back(source);
+	drawPoints(param);
+}
+
+void Renderer::drawPointCloud(const PointCloud& cloud, DrawParams& param)
+{
+	auto frustum = Frustum::fromMatrix(param.vsParams.p * param.vsParams.mv);
+	pointSources.clear();
+	int first = 0;
+	for (const auto& chunk : cloud.getChunks())
+	{
+		auto posbuf = buffers->posBufs.get(chunk.posId);
+		if (posbuf == nullptr || posbuf->empty() || frustum.test(chunk.bounds) == Frustum::Result::Outside)
+			continue;
+
+		PointSource source;
+		source.positions = &(*posbuf)[0].x;
+		source.count = static_cast<int>(posbuf->size());
+		source.first = first;
+		auto colbuf = buffers->colorBufs.get(chunk.colId);
+		if (colbuf != nullptr && static_cast<int>(colbuf->size()) >= source.count)
+			source.colors = colbuf->data();
+		pointSources.push_back(source);
+		first += source.count;
+	}
+	drawPoints(param);
+}
+
+// the points of pointSources
+void Renderer::drawPoints(const DrawParams& param)
+{
+	int total = 0;
+	for (const auto& source : pointSources)
+		total += source.count;
+	auto area = getDrawArea();
+	if (total == 0 || area.empty())
+		return;
+
+	const auto& vsp = param.vsParams;
+	float n = vsp.zNear;
+	float f = vsp.zFar;
+	float p1 = (f - n) / 2;
+	float p2 = (f + n) / 2;
+	depthBuffer.setRange(n, f);
+
+	const Matrix4f& mv = vsp.mv;
+	Matrix4f mvp = vsp.p * vsp.mv;
+	int size = MathUtility::clamp(param.pointSize, 1, POINT_TILE_SIZE);
+	int half = (size - 1) / 2;
+	auto packPoint = [](const Vector4f& col) {
+		auto channel = [](float v) { return static_cast<Uint32>(MathUtility::clamp(v, 0.f, 1.f) * 255.f + 0.5f); };
+		return (channel(col.x) << 16) | (channel(col.y) << 8) | channel(col.z);
+	};
+	Uint32 drawColor = packPoint(param.pointColor);
+
+	int tileCols = (width + POINT_TILE_SIZE - 1) / POINT_TILE_SIZE;
+	int tileRows = (height + POINT_TILE_SIZE - 1) / POINT_TILE_SIZE;
+	int tileCount = tileCols * tileRows;
+	// the number of jobs only depends on the points, so neither does the order of the splats
+	int jobs = MathUtility::clamp((total + POINTS_PER_JOB - 1) / POINTS_PER_JOB, 1, MAX_POINT_JOBS);
+	if (static_cast<int>(pointSplats.size()) < total)
+	{
+		pointSplats.resize(total);
+		unsortedSplats.resize(total);
+		splatTiles.resize(total);
+	}
+	pointBinOffsets.resize(jobs * (tileCount + 1));
+	auto jobBegin = [&](int job) { return static_cast<int>(static_cast<int64_t>(total) * job / jobs); };
+
+	auto project = [&](int j0, int j1) {
+		for (int job = j0; job < j1; ++job)
+		{
+			int begin = jobBegin(job);
+			int end = jobBegin(job + 1);
+			int* offsets = &pointBinOffsets[job * (tileCount + 1)];
+			std::fill(offsets, offsets + tileCount + 1, 0);
+
+			// copies, the compiler could not keep what the stores below might alias in registers
+			const ScreenRect clip = area;
+			const float sw = static_cast<float>(width);
+			const float sh = static_cast<float>(height);
+			const int cols = tileCols;
+			PointSplat* out = &unsortedSplats[begin];
+			int* outTiles = &splatTiles[begin];
+
+			int count = 0;
+			auto source = std::upper_bound(pointSources.begin(), pointSources.end(), begin,
+				[](int i, const PointSource& s) { return i < s.first; }) - 1;
+			for (; source != pointSources.end() && source->first < end; ++source)
 			{
-				auto boneId = pairW.first;
-				auto weight = pairW.second;
-				transform = transform + (weight * param.boneTransform[boneId]);
+				const PointSource src = *source;
+				int i0 = std::max(begin - src.first, 0);
+				int i1 = std::min(end - src.first, src.count);
+				for (int i = i0; i < i1; ++i)
+				{
+					const float* p = src.positions + static_cast<size_t>(i) * src.stride;
+					Vector4f pos(p[0], p[1], p[2], 1.f);
+					if (src.boneWeights != nullptr && i < static_cast<int>(src.boneWeights->size()))
+					{
+						Matrix4f transform = Matrix4f::Zero();
+						for (const auto& pairW : (*src.boneWeights)[i])
+							transform = transform + (pairW.second * param.boneTransform[pairW.first]);
+						pos = transform * pos;
+					}
+					auto dot = [&pos](const float* row) { return row[0] * pos.x + row[1] * pos.y + row[2] * pos.z + row[3] * pos.w; };
+
+					// in front of the near plane and not beyond the far one, camera faces -z
+					float viewZ = dot(&mv.num[8]);
+					if (viewZ > -n || viewZ < -f)
+						continue;
+
+					float invW = 1.f / dot(&mvp.num[12]);
+					float sx = (dot(&mvp.num[0]) * invW + 1.f) / 2 * sw;
+					float sy = (dot(&mvp.num[4]) * invW + 1.f) / 2 * sh;
+					if (!(sx >= clip.x0 - size && sx < clip.x1 + size + 1 && sy >= clip.y0 - size && sy < clip.y1 + size + 1))
+						continue;
+					// floor, what is left is at most a tile to the left of or below the screen
+					int x = static_cast<int>(sx + POINT_TILE_SIZE) - POINT_TILE_SIZE;
+					int y = static_cast<int>(sy + POINT_TILE_SIZE) - POINT_TILE_SIZE;
+					int x0 = std::max(x - half, clip.x0);
+					int y0 = std::max(y - half, clip.y0);
+					if (x0 > std::min(x - half + size - 1, clip.x1) || y0 > std::min(y - half + size - 1, clip.y1))
+						continue;
+
+					PointSplat splat;
+					splat.x = static_cast<int16_t>(x);
+					splat.y = static_cast<int16_t>(y);
+					splat.z = dot(&mvp.num[8]) * invW * p1 + p2;
+					splat.color = src.colors != nullptr ? packPoint(src.colors[i]) : drawColor;
+					int tile = (y0 / POINT_TILE_SIZE) * cols + x0 / POINT_TILE_SIZE;
+					out[count] = splat;
+					outTiles[count] = tile;
+					++offsets[tile + 1];
+					++count;
+				}
 			}
-			vsp.allBonesTransform = transform;
+
+			// counting sort by tile, the offsets then give where each bin starts
+			for (int t = 0; t < tileCount; ++t)
+				offsets[t + 1] += offsets[t];
+			PointSplat* sorted = &pointSplats[begin];
+			for (int k = 0; k < count; ++k)
+				sorted[offsets[outTiles[k]]++] = out[k];
+			for (int t = tileCount; t > 0; --t)
+				offsets[t] = offsets[t - 1];
+			offsets[0] = 0;
 		}
+	};
+	parallelFor(jobs, project, 1);
 
-		auto homoPos = pfVertexShader(vsp);
-		homoPos = (1.f / homoPos.w) * homoPos;
+	bool equalDepth = renderPass == RenderPass::ColorEqualDepth;
+	bool writeColor = renderPass != RenderPass::DepthOnly;
+	auto drawTiles = [&](int t0, int t1) {
+		for (int tile = t0; tile < t1; ++tile)
+		{
+			int tx = tile % tileCols;
+			int ty = tile / tileCols;
+			int rx0 = std::max(tx * POINT_TILE_SIZE, area.x0);
+			int ry0 = std::max(ty * POINT_TILE_SIZE, area.y0);
+			int rx1 = std::min((tx + 1) * POINT_TILE_SIZE - 1, area.x1);
+			int ry1 = std::min((ty + 1) * POINT_TILE_SIZE - 1, area.y1);
+			if (rx0 > rx1 || ry0 > ry1)
+				continue;
 
-		int ti = (homoPos.x + 1.0) / 2 * renderTexture.width;
-		int tj = (homoPos.y + 1.0) / 2 * renderTexture.height;
+			// the closest splat of every pixel, first in order on a tie. a point covers its pixels entirely,
+			// so where the closest fails the depth test of a sample the others do too
+			float closest[POINT_TILE_SIZE * POINT_TILE_SIZE];
+			Uint32 colors[POINT_TILE_SIZE * POINT_TILE_SIZE];
+			int tw = rx1 - rx0 + 1;
+			int th = ry1 - ry0 + 1;
+			const float none = std::numeric_limits<float>::lowest();
+			std::fill(closest, closest + tw * th, none);
 
-		setColor(ti, tj, Vector4f{ 255, 0, 0, 0 });
+			for (int job = 0; job < jobs; ++job)
+			{
+				int begin = jobBegin(job);
+				const int* offsets = &pointBinOffsets[job * (tileCount + 1)];
+				// a splat reaches at most one tile to the right and one up from the one it is binned in
+				for (int by = std::max(ty - 1, 0); by <= ty; ++by)
+				{
+					for (int bx = std::max(tx - 1, 0); bx <= tx; ++bx)
+					{
+						int bin = by * tileCols + bx;
+						for (int k = begin + offsets[bin]; k < begin + offsets[bin + 1]; ++k)
+						{
+							const auto& splat = pointSplats[k];
+							int x0 = std::max(splat.x - half, rx0) - rx0;
+							int y0 = std::max(splat.y - half, ry0) - ry0;
+							int x1 = std::min(splat.x - half + size - 1, rx1) - rx0;
+							int y1 = std::min(splat.y - half + size - 1, ry1) - ry0;
+							for (int y = y0; y <= y1; ++y)
+							{
+								for (int x = x0; x <= x1; ++x)
+								{
+									int i = y * tw + x;
+									if (splat.z > closest[i])
+									{
+										closest[i] = splat.z;
+										colors[i] = splat.color;
+									}
+								}
+							}
+						}
+					}
+				}
+			}
+
+			for (int y = 0; y < th; ++y)
+			{
+				for (int x = 0; x < tw; ++x)
+				{
+					int i = y * tw + x;
+					if (closest[i] == none)
+						continue;
+
+					auto depth = depthBuffer.getSamples(rx0 + x, ry0 + y);
+					unsigned int mask = 0;
+					for (int s = 0; s < sampleCount; ++s)
+					{
+						if (depth.test(s, closest[i], equalDepth))
+							mask |= 1u << s;
+					}
+					if (mask != 0 && writeColor)
+					{
+						Uint32 c = colors[i];
+						writeSamples(rx0 + x, ry0 + y, mask, Vector4f(static_cast<float>((c >> 16) & 0xff), static_cast<float>((c >> 8) & 0xff),
+							static_cast<float>(c & 0xff), 255.f));
+					}
+				}
+			}
+		}
+	};
+	parallelFor(tileCount, drawTiles, 1);
+}
+
+ScreenRect ScreenRect::merge(const ScreenRect& a, const ScreenRect& b)
+{
+	if (a.empty())
+		return b;
+	if (b.empty())
+		return a;
+
+	ScreenRect res;
+	res.x0 = std::min(a.x0, b.x0);
+	res.y0 = std::min(a.y0, b.y0);
+	res.x1 = std::max(a.x1, b.x1);
+	res.y1 = std::max(a.y1, b.y1);
+	return res;
+}
+
+ScreenRect ScreenRect::intersect(const ScreenRect& a, const ScreenRect& b)
+{
+	ScreenRect res;
+	res.x0 = std::max(a.x0, b.x0);
+	res.y0 = std::max(a.y0, b.y0);
+	res.x1 = std::min(a.x1, b.x1);
+	res.y1 = std::min(a.y1, b.y1);
+	return res;
+}
+
+bool TriangleSetup::setup(const Vector4f* pos)
+{
+	for (int k = 0; k < 3; ++k)
+		portPos[k] = pos[k];
+
+	for (int k = 0; k < 3; ++k)
+	{
+		const auto& from = pos[(k + 1) % 3];
+		const auto& to = pos[(k + 2) % 3];
+		edgeX[k] = from.x;
+		edgeY[k] = from.y;
+		edgeDx[k] = to.y - from.y;
+		edgeDy[k] = -(to.x - from.x);
 	}
 
-	
+	// edge 0 at vertex 0, the same for the three edges
+	float area = (pos[0].x - edgeX[0]) * edgeDx[0] + (pos[0].y - edgeY[0]) * edgeDy[0];
+	if (area == 0.f)
+		return false;
+	invArea = 1.f / area;
+
+	// gradient of barycentric k is edgeD * invArea, so is the one of any affine attribute
+	float w[] = { 1.f / pos[0].w, 1.f / pos[1].w, 1.f / pos[2].w };
+	invW[0] = w[0];
+	invW[1] = (w[0] * edgeDx[0] + w[1] * edgeDx[1] + w[2] * edgeDx[2]) * invArea;
+	invW[2] = (w[0] * edgeDy[0] + w[1] * edgeDy[1] + w[2] * edgeDy[2]) * invArea;
+	varyingCount = 0;
+	return true;
 }
 
-bool Renderer::isInside(float x, float y, const Vector4f* triPos)
+void TriangleSetup::setupVaryings(const float* varyingBuf, int stride, const int* indices, int count)
+{
+	varyingCount = std::min(count, MAX_VARYINGS);
+	float w[] = { 1.f / portPos[0].w, 1.f / portPos[1].w, 1.f / portPos[2].w };
+	for (int v = 0; v < varyingCount; ++v)
+	{
+		const float* varying = varyingBuf + v * stride;
+		float q[] = { varying[indices[0]] * w[0], varying[indices[1]] * w[1], varying[indices[2]] * w[2] };
+		varyings[v][0] = q[0];
+		varyings[v][1] = (q[0] * edgeDx[0] + q[1] * edgeDx[1] + q[2] * edgeDx[2]) * invArea;
+		varyings[v][2] = (q[0] * edgeDy[0] + q[1] * edgeDy[1] + q[2] * edgeDy[2]) * invArea;
+	}
+}
+
+bool TriangleSetup::getBarycentricCoord(float x, float y, Vector3f& barycentricCoord) const
 {
 	auto sign = [](float num) -> int {
 		if (num < 0)
@@ -70,84 +871,120 @@ bool Renderer::isInside(float x, float y, const Vector4f* triPos)
 		return 1;
 	};
 
-	Vector3f a = Vector3f{ triPos[0].x, triPos[0].y, 0 };
-	Vector3f b = Vector3f{ triPos[1].x, triPos[1].y, 0 };
-	Vector3f c = Vector3f{ triPos[2].x, triPos[2].y, 0 };
-	Vector3f p = { x, y, 0 };
+	float e[3];
+	for (int k = 0; k < 3; ++k)
+		e[k] = (x - edgeX[k]) * edgeDx[k] + (y - edgeY[k]) * edgeDy[k];
 
-	Vector3f ab = b - a;
-	Vector3f bc = c - b;
-	Vector3f ca = a - c;
+	if (sign(e[0]) != sign(e[1]) || sign(e[1]) != sign(e[2]))
+		return false;
 
-	Vector3f ap = p - a;
-	Vector3f bp = p - b;
-	Vector3f cp = p - c;
-
-	return sign(ab.x * ap.y - ap.x * ab.y) == sign(bc.x * bp.y - bp.x * bc.y) &&
-		sign(bc.x * bp.y - bp.x * bc.y) == sign(ca.x * cp.y - cp.x * ca.y);
+	barycentricCoord = { e[0] * invArea, e[1] * invArea, e[2] * invArea };
+	return true;
 }
 
-Vector3f Renderer::getBarycentricCoord(float x, float y, const Vector4f* triPos)
+float TriangleSetup::getFarthestDepth(int x, int y) const
 {
-	Vector3f a = Vector3f{ triPos[0].x, triPos[0].y, 0};
-	Vector3f b = Vector3f{ triPos[1].x, triPos[1].y, 0 };
-	Vector3f c = Vector3f{ triPos[2].x, triPos[2].y, 0 };
-	Vector3f p = { x, y, 0 };
-
-	Vector3f ab = b - a;
-	Vector3f bc = c - b;
-	Vector3f ca = a - c;
+	// the depth is affine in screen space, its minimum over the pixel is at a corner
+	float z = std::numeric_limits<float>::max();
+	for (int c = 0; c < 4; ++c)
+	{
+		float cx = static_cast<float>(x + (c & 1));
+		float cy = static_cast<float>(y + (c >> 1));
+		float zc = 0.f;
+		for (int k = 0; k < 3; ++k)
+			zc += ((cx - edgeX[k]) * edgeDx[k] + (cy - edgeY[k]) * edgeDy[k]) * invArea * portPos[k].z;
+		z = std::min(z, zc);
+	}
+	return std::max(z, std::min({ portPos[0].z, portPos[1].z, portPos[2].z }));
+}
 
-	Vector3f ap = p - a;
-	Vector3f bp = p - b;
-	Vector3f cp = p - c;
+void TriangleSetup::interpolate(float x, float y, float* out) const
+{
+	float dx = x - portPos[0].x;
+	float dy = y - portPos[0].y;
+	float w = 1.f / (invW[0] + invW[1] * dx + invW[2] * dy);
+	for (int v = 0; v < varyingCount; ++v)
+		out[v] = (varyings[v][0] + varyings[v][1] * dx + varyings[v][2] * dy) * w;
+}
 
-	Vector3f res;
-	res.x = (bp.crossProduct(bc)).z / (-ab).crossProduct(bc).z;
-	res.y = (cp.crossProduct(ca)).z / (-bc).crossProduct(ca).z;
-	res.z = (ap.crossProduct(ab)).z / (-ca).crossProduct(ab).z;
+// varying = a / b with a and b affine, so d/dx = (a_x - varying * b_x) / b
+void TriangleSetup::getDerivatives(float x, float y, int v, float& dx, float& dy) const
+{
+	float ox = x - portPos[0].x;
+	float oy = y - portPos[0].y;
+	float w = 1.f / (invW[0] + invW[1] * ox + invW[2] * oy);
+	float value = (varyings[v][0] + varyings[v][1] * ox + varyings[v][2] * oy) * w;
+	dx = (varyings[v][1] - value * invW[1]) * w;
+	dy = (varyings[v][2] - value * invW[2]) * w;
+}
 
-	return res;
+void FragmentShaderParams::getDerivatives(int varying, float& dx, float& dy) const
+{
+	if (triangle == nullptr)
+	{
+		dx = dy = 0.f;
+		return;
+	}
+	triangle->getDerivatives(shadePos.x, shadePos.y, varying, dx, dy);
 }
 
-void Renderer::drawTriangle(DrawParams param)
+// vertex stage shared by every path, fills the post-transform buffers.
+// false if the draw has no vertices, e.g. its buffers were released
+bool Renderer::processVertices(DrawParams& param, bool withVaryings)
 {
 	VertexShaderParams& vsp = param.vsParams;
-	FragmentShaderParams& fsp = param.fsParams;
 
-	auto &posbuf = posBufs.at(param.posId.id);
-	auto &indbuf = indBufs.at(param.indId.id);
-	//auto colbuf = colorBufs.at(param.colId.id);
-	auto &uvbuf = uvBufs.at(param.uvId.id);
-	auto &norbuf = normalBufs.at(param.norId.id);
-	auto &boneWeightBuf = boneWeightBufs.at(param.boneWeightId.id);
-
-	std::vector<Vector4f> portPosBuf;
-	std::vector<Vector4f> viewPosBuf;
-	std::vector<Vector3f> viewNormalBuf;
-	std::vector<bool> isBack;
-	portPosBuf.reserve(posbuf.size());
-	viewPosBuf.reserve(posbuf.size());
-	viewNormalBuf.reserve(posbuf.size());
+	auto vtxbuf = buffers->vertexBufs.get(param.vtxId);
+	auto posbuf = buffers->posBufs.get(param.posId);
+	auto norbuf = buffers->normalBufs.get(param.norId);
+	auto uvbuf = buffers->uvBufs.get(param.uvId);
+	auto boneWeightBuf = buffers->boneWeightBufs.get(param.boneWeightId);
+
+	if (vtxbuf != nullptr && vtxbuf->layout.positionOffset < 0)
+		vtxbuf = nullptr;
+	if (vtxbuf == nullptr && posbuf == nullptr)
+		return false;
+
+	int vertexCount = vtxbuf != nullptr ? vtxbuf->size() : static_cast<int>(posbuf->size());
+	int stride = withVaryings ? varyingCount : 0;
+	portPosBuf.clear();
+	viewPosBuf.clear();
+	portPosBuf.reserve(vertexCount);
+	viewPosBuf.reserve(vertexCount);
+	varyingBuf.resize(stride * vertexCount);
 
 	float f = vsp.zFar;
 	float n = vsp.zNear;
 	float p1 = (f - n) / 2;
 	float p2 = (f + n) / 2;
+	depthBuffer.setRange(n, f);
 
-	for (int i = 0;i < posbuf.size(); ++i)
+	for (int i = 0; i < vertexCount; ++i)
 	{
-		vsp.pos = static_cast<Vector4f>(posbuf[i]);
-		vsp.pos.w = 1;
-		vsp.pointNormal = norbuf[i];
+		if (vtxbuf != nullptr)
+		{
+			// the compact formats are unpacked here, nothing else sees them
+			const auto& layout = vtxbuf->layout;
+			const float* v = &vtxbuf->data[i * layout.stride];
+			vsp.pos = VertexFormat::fetchPosition(v, layout);
+			vsp.pointNormal = layout.normalOffset >= 0 ? VertexFormat::fetchNormal(v, layout) : Vector3f();
+			vsp.uv = layout.uvOffset >= 0 ? VertexFormat::fetchUv(v, layout) : Vector2f{ 0.f, 0.f };
+		}
+		else
+		{
+			vsp.pos = static_cast<Vector4f>((*posbuf)[i]);
+			vsp.pos.w = 1;
+			vsp.pointNormal = norbuf != nullptr && i < static_cast<int>(norbuf->size()) ? (*norbuf)[i] : Vector3f();
+			vsp.uv = uvbuf != nullptr && i < static_cast<int>(uvbuf->size()) ? (*uvbuf)[i] : Vector2f{ 0.f, 0.f };
+		}
 
 		// calculate allBoneTransform
 		Matrix4f transform = Matrix4f::Zero();
 
 		vsp.allBonesTransform = Matrix4f::Identity();
-		if (boneWeightBuf.size() > 0)
+		if (boneWeightBuf != nullptr && i < static_cast<int>(boneWeightBuf->size()))
 		{
-			auto& posBoneWeights = boneWeightBuf[i];
+			auto& posBoneWeights = (*boneWeightBuf)[i];
 			for (const auto& pairW : posBoneWeights)
 			{
 				auto boneId = pairW.first;
@@ -165,80 +1002,263 @@ void Renderer::drawTriangle(DrawParams param)
 		homoPos.y = (1.f / homoPos.w) * homoPos.y;
 		homoPos.z = (1.f / homoPos.w) * homoPos.z;
 
-		homoPos.x = (homoPos.x + 1.0) / 2 * renderTexture.width;
-		homoPos.y = (homoPos.y + 1.0) / 2 * renderTexture.height;
+		homoPos.x = (homoPos.x + 1.0) / 2 * width;
+		homoPos.y = (homoPos.y + 1.0) / 2 * height;
 		homoPos.z = homoPos.z * p1 + p2;
 
 		portPosBuf.push_back(homoPos);
 		viewPosBuf.push_back(vsp.viewPos);
-		viewNormalBuf.push_back(vsp.pointNormal);
+		for (int v = 0; v < stride; ++v)
+			varyingBuf[v * vertexCount + i] = vsp.varyings[v];
 	}
+	return true;
+}
+
+// pixel bounds {xMin, yMin, xMax, yMax} of a triangle clamped to the viewport, false if empty
+bool Renderer::getTriangleBounds(const Vector4f* portPos, int bounds[4])
+{
+	float xMin = portPos[0].x;
+	float xMax = portPos[0].x;
+	float yMin = portPos[0].y;
+	float yMax = portPos[0].y;
 
-	for (auto it = indbuf.begin(); it != indbuf.end(); ++it)
+	for (int k = 1; k < 3; ++k)
 	{
-		int i[] = { it->x, it->y, it->z };
+		xMin = std::min(xMin, portPos[k].x);
+		xMax = std::max(xMax, portPos[k].x);
+		yMin = std::min(yMin, portPos[k].y);
+		yMax = std::max(yMax, portPos[k].y);
+	}
+
+	auto area = getDrawArea();
+	xMin = std::max(static_cast<float>(area.x0), xMin);
+	xMax = std::min(static_cast<float>(area.x1), xMax);
+	yMin = std::max(static_cast<float>(area.y0), yMin);
+	yMax = std::min(static_cast<float>(area.y1), yMax);
+
+	bounds[0] = static_cast<int>(xMin);
+	bounds[1] = static_cast<int>(yMin);
+	bounds[2] = static_cast<int>(xMax);
+	bounds[3] = static_cast<int>(yMax);
+	return xMin <= xMax && yMin <= yMax;
+}
+
+// depth at a sample, the same arithmetic for every pass so an equal-depth test matches the pre-pass exactly
+float Renderer::interpolateDepth(const Vector3f& barycentricCoord, const Vector4f* portPos)
+{
+	return barycentricCoord.x * portPos[0].z + barycentricCoord.y * portPos[1].z + barycentricCoord.z * portPos[2].z;
+}
+
+void Renderer::drawTriangle(DrawParams& param)
+{
+	VertexShaderParams& vsp = param.vsParams;
+	FragmentShaderParams& fsp = param.fsParams;
+
+	auto indbuf = buffers->indBufs.get(param.indId);
+	if (indbuf == nullptr || !processVertices(param, true))
+		return;
+	int vertexCount = static_cast<int>(portPosBuf.size());
+	updateLightTiles(fsp.lights, vsp.p, vsp.zNear);
+
+	bool equalDepth = renderPass == RenderPass::ColorEqualDepth;
+
+	// picked once per draw, the fragments of a material call its variant directly. any other shader
+	// bound, through setFragmentShader or a command buffer, runs as it is
+	MaterialShader materialShader = nullptr;
+	if (fsp.material != nullptr)
+	{
+		auto bound = pfFragmentShader.target<MaterialShader>();
+		if (bound != nullptr && *bound == fsp.material->specializes)
+			materialShader = fsp.material->shader;
+	}
+
+	int triCount = indbuf->size();
+	for (int t = 0; t < triCount; ++t)
+	{
+		auto indices = (*indbuf)[t];
+		int i[] = { indices.x, indices.y, indices.z };
 		Vector4f viewPos[] = { viewPosBuf[i[0]], viewPosBuf[i[1]], viewPosBuf[i[2]] };
 		if (isBackFace(viewPos))
 			continue;
 		Vector4f portPos[] = { portPosBuf[i[0]], portPosBuf[i[1]], portPosBuf[i[2]] };
-		//Vector4f color[] = { colbuf[i[0]], colbuf[i[1]], colbuf[i[2]] };
-		Vector2f uv[] = { uvbuf[i[0]], uvbuf[i[1]], uvbuf[i[2]] };
-		Vector3f normals[] = { viewNormalBuf[i[0]].normalize(), viewNormalBuf[i[1]].normalize(), viewNormalBuf[i[2]].normalize()};
 
-		float xMin = portPos[0].x;
-		float xMax = portPos[0].x;
-		float yMin = portPos[0].y;
-		float yMax = portPos[0].y;
+		int bounds[4];
+		TriangleSetup tri;
+		if (!getTriangleBounds(portPos, bounds) || !tri.setup(portPos))
+			continue;
+
+		tri.setupVaryings(varyingBuf.data(), vertexCount, i, varyingCount);
 
-		for (const auto& v : portPos)
-		{
-			xMin = std::min(xMin, v.x);
-			xMax = std::max(xMax, v.x);
-			yMin = std::min(yMin, v.y);
-			yMax = std::max(yMax, v.y);
-		}
-		
-		xMin = std::max(0.f, xMin);
-		xMax = std::min(static_cast<float>(renderTexture.width - 1), xMax);
-		yMin = std::max(0.f, yMin);
-		yMax = std::min(static_cast<float>(renderTexture.height - 1), yMax);
+		// the fragment shader runs once per block of rate x rate pixels, whatever the sample count.
+		// blocks are aligned to a 4x4 grid so a block never straddles two tiles
+		auto shade = [&](const Vector2f& pos, int tile, int rate) {
+			tri.interpolate(pos.x, pos.y, fsp.varyings);
+			fsp.triangle = &tri;
+			fsp.shadePos = pos;
+			fsp.shadingRate = rate;
+
+			fsp.tileLights = lightTileIndices.data() + lightTileOffsets[tile];
+			fsp.tileLightCount = lightTileOffsets[tile + 1] - lightTileOffsets[tile];
+
+			return materialShader != nullptr ? materialShader(fsp) : pfFragmentShader(fsp);
+		};
 
-		for (int i = xMin; i <= xMax; ++i)
+		for (int cx = bounds[0] & ~3; cx <= bounds[2]; cx += 4)
 		{
-			for (int j = yMin; j <= yMax; ++j)
+			for (int cy = bounds[1] & ~3; cy <= bounds[3]; cy += 4)
 			{
-				float x = i + 0.5f;
-				float y = j + 0.5f;
+				int tile = (cy / LIGHT_TILE_SIZE) * lightTileCols + cx / LIGHT_TILE_SIZE;
+				int rate = getShadingRate(param.shadingRate, tile);
 
-				if (isInside(x, y, portPos))
+				for (int bx = cx; bx < cx + 4; bx += rate)
 				{
-					auto barycentricCoord = getBarycentricCoord(x, y, portPos);
-					auto alpha = barycentricCoord.x;
-					auto beta = barycentricCoord.y;
-					auto gamma = barycentricCoord.z;
-
-					auto z_i = alpha * portPos[0].z + beta * portPos[1].z + gamma * portPos[2].z;
-
-					if (z_i > zBuf[getIndex(i, j)])
+					for (int by = cy; by < cy + 4; by += rate)
 					{
-						zBuf[getIndex(i, j)] = z_i;
-						// auto col_i = MathUtility::interpolateByBaryCentric(color, portPos, alpha, beta, gamma);
-						auto uv_i = MathUtility::interpolateByBaryCentric(uv, portPos, alpha, beta, gamma);
-						auto normal_i = MathUtility::interpolateByBaryCentric(normals, portPos, alpha, beta, gamma).normalize();
-						auto viewPos_i = MathUtility::interpolateByBaryCentric(viewPos, portPos, alpha, beta, gamma);
-						// fsp.color = col_i;
-						fsp.uv = uv_i;
-						fsp.normal = normal_i;
-						fsp.viewPos = viewPos_i;
-
-						auto fcol = pfFragmentShader(fsp);
-						setColor(i, j, fcol);
+						bool shaded = false;
+						Vector4f fcol;
+						int iEnd = std::min(bx + rate - 1, bounds[2]);
+						int jEnd = std::min(by + rate - 1, bounds[3]);
+						for (int i = std::max(bx, bounds[0]); i <= iEnd; ++i)
+						{
+							for (int j = std::max(by, bounds[1]); j <= jEnd; ++j)
+							{
+								Vector2f shadePos;
+								auto mask = coverSamples(i, j, tri, equalDepth, shadePos);
+								if (mask == 0)
+									continue;
+
+								// coverage and depth stay per pixel, the color of the first covered one is broadcast
+								if (!shaded)
+								{
+									fcol = shade(shadePos, tile, rate);
+									shaded = true;
+								}
+								writeSamples(i, j, mask, fcol);
+							}
+						}
 					}
 				}
 			}
 		}
+	}
+	fsp.triangle = nullptr;
+}
 
+// coverage and depth test of every sample of a pixel, returns the mask of the samples that passed.
+// shadePos : the first covered sample, where the pixel is shaded so the attributes are never extrapolated
+unsigned int Renderer::coverSamples(int x, int y, const TriangleSetup& tri, bool equalDepth, Vector2f& shadePos)
+{
+	auto depth = depthBuffer.getSamples(x, y);
 
+	unsigned int mask = 0;
+	for (int s = 0; s < sampleCount; ++s)
+	{
+		float sx = x + sampleOffsets[s].x;
+		float sy = y + sampleOffsets[s].y;
+		Vector3f barycentricCoord;
+		if (!tri.getBarycentricCoord(sx, sy, barycentricCoord))
+			continue;
+
+		auto z_s = interpolateDepth(barycentricCoord, tri.portPos);
+
+		// after a depth pre-pass only the front-most fragment is shaded, and the depth is already final
+		if (depth.test(s, z_s, equalDepth))
+		{
+			if (mask == 0)
+				shadePos = Vector2f{ sx, sy };
+			mask |= 1u << s;
+		}
+	}
+	return mask;
+}
+
+int Renderer::getShadingRate(ShadingRate drawRate, int tile) const
+{
+	if (!variableRateShading)
+		return 1;
+
+	int rate = static_cast<int>(drawRate);
+	if (tile < static_cast<int>(tileShadingRates.size()))
+		rate = std::min(rate, static_cast<int>(tileShadingRates[tile]));
+	return rate;
+}
+
+void Renderer::updateShadingRates()
+{
+	tileShadingRates.assign(lightTileCols * lightTileRows, ShadingRate::Rate1x1);
+
+	for (int ty = 0; ty < lightTileRows; ++ty)
+	{
+		for (int tx = 0; tx < lightTileCols; ++tx)
+		{
+			double sum = 0.0, sum2 = 0.0;
+			int count = 0;
+			int xEnd = std::min((tx + 1) * LIGHT_TILE_SIZE, width);
+			int yEnd = std::min((ty + 1) * LIGHT_TILE_SIZE, height);
+			for (int y = ty * LIGHT_TILE_SIZE; y < yEnd; ++y)
+			{
+				for (int x = tx * LIGHT_TILE_SIZE; x < xEnd; ++x)
+				{
+					auto col = renderTexture.getColor(x, height - 1 - y);
+					double luma = 0.299 * col.x + 0.587 * col.y + 0.114 * col.z;
+					sum += luma;
+					sum2 += luma * luma;
+					++count;
+				}
+			}
+
+			// variance in 8 bit levels^2, a 4x4 block of a tile this flat is within a level or two
+			double mean = sum / count;
+			double variance = sum2 / count - mean * mean;
+			auto& rate = tileShadingRates[ty * lightTileCols + tx];
+			if (variance < 4.0)
+				rate = ShadingRate::Rate4x4;
+			else if (variance < 25.0)
+				rate = ShadingRate::Rate2x2;
+		}
+	}
+}
+
+// z-prepass and shadow maps, no attribute interpolation and no fragment shader
+void Renderer::drawTriangleDepth(DrawParams& param)
+{
+	auto indbuf = buffers->indBufs.get(param.indId);
+	if (indbuf == nullptr || !processVertices(param, false))
+		return;
+
+	int triCount = indbuf->size();
+	for (int t = 0; t < triCount; ++t)
+	{
+		auto tri = (*indbuf)[t];
+		Vector4f viewPos[] = { viewPosBuf[tri.x], viewPosBuf[tri.y], viewPosBuf[tri.z] };
+		if (isBackFace(viewPos))
+			continue;
+		Vector4f portPos[] = { portPosBuf[tri.x], portPosBuf[tri.y], portPosBuf[tri.z] };
+
+		int bounds[4];
+		TriangleSetup setup;
+		if (!getTriangleBounds(portPos, bounds) || !setup.setup(portPos))
+			continue;
+
+		for (int i = bounds[0]; i <= bounds[2]; ++i)
+		{
+			for (int j = bounds[1]; j <= bounds[3]; ++j)
+			{
+				auto depth = depthBuffer.getSamples(i, j);
+				for (int s = 0; s < sampleCount; ++s)
+				{
+					float x = i + sampleOffsets[s].x;
+					float y = j + sampleOffsets[s].y;
+
+					Vector3f barycentricCoord;
+					if (!setup.getBarycentricCoord(x, y, barycentricCoord))
+						continue;
+
+					auto z_s = conservativeDepth ? setup.getFarthestDepth(i, j) : interpolateDepth(barycentricCoord, portPos);
+					depth.test(s, z_s, false);
+				}
+			}
+		}
 	}
 }
 
@@ -257,61 +1277,81 @@ bool Renderer::isBackFace(const Vector4f* triPos)
 // from left-bottom, line first
 int Renderer::getIndex(int x, int y)
 {
-	return y * renderTexture.width + x;
+	return y * width + x;
 }
 
 // from left-bottom, line first
 void Renderer::setColor(int x, int y, const Vector4f& col)
 {
 	// map to left-top texture coord
-	y = renderTexture.height - 1 - y;
+	y = height - 1 - y;
 	renderTexture.setColor(x, y, col);
 }
 
 pos_buf_id Renderer::addPositionBuf(std::vector<Vector3f>&& posBuf)
 {
-	int id = getNextId();
-	posBufs.insert({ id, std::move(posBuf) });
-	return { id };
+	return buffers->posBufs.insert(std::move(posBuf));
 }
 
 ind_buf_id Renderer::addIndexBuf(std::vector<Vector3i>&& indBuf)
 {
-	int id = getNextId();
-	indBufs.insert({ id, std::move(indBuf) });
-	return { id };
+	IndexBuffer buf;
+	bool fits = std::all_of(indBuf.begin(), indBuf.end(), [](const Vector3i& tri) {
+		return std::min({ tri.x, tri.y, tri.z }) >= 0 && std::max({ tri.x, tri.y, tri.z }) <= 0xffff;
+	});
+	if (fits)
+	{
+		buf.narrow.reserve(indBuf.size() * 3);
+		for (const auto& tri : indBuf)
+		{
+			buf.narrow.push_back(static_cast<uint16_t>(tri.x));
+			buf.narrow.push_back(static_cast<uint16_t>(tri.y));
+			buf.narrow.push_back(static_cast<uint16_t>(tri.z));
+		}
+	}
+	else
+	{
+		buf.wide = std::move(indBuf);
+	}
+	return buffers->indBufs.insert(std::move(buf));
 }
 
 col_buf_id Renderer::addColorBuf(std::vector<Vector4f>&& colorBuf)
 {
-	int id = getNextId();
-	colorBufs.insert({ id, std::move(colorBuf) });
-	return { id };
+	return buffers->colorBufs.insert(std::move(colorBuf));
 }
 
 nor_buf_id Renderer::addNormalBuf(std::vector<Vector3f>&& normalBuf)
 {
-	int id = getNextId();
-	normalBufs.insert({ id, std::move(normalBuf) });
-	return { id };
+	return buffers->normalBufs.insert(std::move(normalBuf));
 }
 
 uv_buf_id Renderer::addUVBuf(std::vector<Vector2f>&& uvBuf)
 {
-	int id = getNextId();
-	uvBufs.insert({ id, std::move(uvBuf) });
-	return { id };
+	return buffers->uvBufs.insert(std::move(uvBuf));
 }
 
 bone_weight_buf_id Renderer::addBoneWeightBuf(std::vector<std::vector<std::pair<int, float>>>&& boneWeightBuf)
 {
-	int id = getNextId();
-	boneWeightBufs.insert({ id, std::move(boneWeightBuf) });
-	return { id };
+	return buffers->boneWeightBufs.insert(std::move(boneWeightBuf));
+}
+
+vtx_buf_id Renderer::addVertexBuf(std::vector<float>&& data, const VertexLayout& layout)
+{
+	VertexBuffer buf;
+	buf.data = std::move(data);
+	buf.layout = layout;
+	return buffers->vertexBufs.insert(std::move(buf));
+}
+
+float Renderer::getDepth(int x, int y) const
+{
+	return depthBuffer.getDepth(x, y, 0);
 }
 
-void Renderer::setVertexShader(std::function<Vector4f(VertexShaderParams&)> vs)
+void Renderer::setVertexShader(std::function<Vector4f(VertexShaderParams&)> vs, int varyingCount)
 {
+	this->varyingCount = std::min(varyingCount, MAX_VARYINGS);
 	this->pfVertexShader = vs;
 }
 void Renderer::setFragmentShader(std::function<Vector4f(FragmentShaderParams&)> fs)
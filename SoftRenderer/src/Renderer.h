@@ -3,12 +3,28 @@
 
 #include "Texture.h"
 #include "Math.h"
-#include <map>
+#include "SlotMap.h"
+#include "DepthBuffer.h"
+#include "HdrImage.h"
+#include "WorkerPool.h"
+#include "VertexFormat.h"
 #include <vector>
+#include <memory>
+#include <cstdint>
 #include <functional>
 //#include "Model.h"
 #include "Light.h"
 
+class ShadowMap;
+class PointCloud;
+class VirtualTexture;
+struct TriangleSetup;
+struct MaterialUniforms;
+
+// floats the vertex shader hands to the fragment shader, interpolated perspective-correct.
+// a shader pair agrees on the layout, the renderer only knows how many are used (see setVertexShader)
+const int MAX_VARYINGS = 16;
+
 struct VertexShaderParams
 {
 	// in
@@ -16,6 +32,8 @@ struct VertexShaderParams
 	Matrix4f p;
 	Matrix4f mv_i_T;	// (MV).inverse().transpose();
 	Vector4f pos;
+	Vector3f pointNormal;
+	Vector2f uv;
 
 	float zNear;
 	float zFar;
@@ -24,31 +42,59 @@ struct VertexShaderParams
 	Matrix4f allBonesTransform;
 
 	// out
-	Vector4f viewPos;
-
-	//in-out 
-	Vector3f pointNormal;
+	Vector4f viewPos;					// the renderer culls back faces with it
+	float varyings[MAX_VARYINGS];
 };
 struct FragmentShaderParams
 {
 	Vector4f portPos[3];	// portView coord
 
-	// interpolated
-	Vector4f viewPos;
-	Vector4f color;
-	Vector3f normal;
-	Vector2f uv;
+	// interpolated, as many as the vertex shader declared
+	float varyings[MAX_VARYINGS];
+
+	// the triangle being shaded at shadePos, once per shadingRate x shadingRate pixels
+	const TriangleSetup* triangle = nullptr;
+	Vector2f shadePos;
+	int shadingRate = 1;
+	// screen space derivatives of a varying per pixel, zero outside triangles
+	void getDerivatives(int varying, float& dx, float& dy) const;
 	
 	// for texture
 	std::vector<std::shared_ptr<Texture>> textureVec;
+	// streamed in place of textureVec[i] when it is set, nullptr otherwise
+	std::vector<std::shared_ptr<VirtualTexture>> virtualTextureVec;
 	int diffuseTextureIdx = -1;
 	int specularTextureIdx = -1;
 
+	// set by Material::bind. while the bound fragment shader is the one the material specializes,
+	// its variant runs instead and reads the constants of the material rather than the ones below
+	const MaterialUniforms* material = nullptr;
+
 	Vector3f Ka;
 	Vector3f Kd;
 	Vector3f Ks;
 	float Ns;
 	std::vector<Light> lights;
+	std::vector<std::shared_ptr<ShadowMap>> shadowMaps;
+
+	// indices into lights affecting the current screen tile, nullptr means every light
+	const int* tileLights = nullptr;
+	int tileLightCount = 0;
+};
+
+enum class RenderPass
+{
+	Color,				// shade and write depth
+	DepthOnly,			// only write the depth, for the z-prepass and shadow maps
+	ColorEqualDepth,	// after a depth-only pass, shade the fragments whose depth equals the stored one, depth untouched
+};
+
+// pixels sharing one fragment shader invocation, per side
+enum class ShadingRate
+{
+	Rate1x1 = 1,
+	Rate2x2 = 2,
+	Rate4x4 = 4,
 };
 
 enum class Primitive
@@ -58,38 +104,84 @@ enum class Primitive
 	MAX_SIZE,
 };
 
+// handles into BufferStore, a default one refers to nothing
 struct pos_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
 };
 
 struct ind_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
 };
 
 struct col_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
 };
 
 struct nor_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
 };
 
 struct uv_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
 };
 
 struct bone_weight_buf_id
 {
 	int id = 0;
+	unsigned int generation = 0;
+};
+
+struct vtx_buf_id
+{
+	int id = 0;
+	unsigned int generation = 0;
+};
+
+// one interleaved buffer for all the per-vertex attributes of a mesh
+struct VertexBuffer
+{
+	std::vector<float> data;
+	VertexLayout layout;
+
+	int size() const { return layout.stride > 0 ? static_cast<int>(data.size()) / layout.stride : 0; };
+};
+
+// the triangles of a mesh, 16-bit when every index fits
+struct IndexBuffer
+{
+	std::vector<Vector3i> wide;
+	std::vector<uint16_t> narrow;		// 3 per triangle, used when wide is empty
+
+	int size() const { return wide.empty() ? static_cast<int>(narrow.size() / 3) : static_cast<int>(wide.size()); };
+	Vector3i operator[](int t) const
+	{
+		if (!wide.empty())
+			return wide[t];
+		const uint16_t* i = &narrow[static_cast<size_t>(t) * 3];
+		return Vector3i{ i[0], i[1], i[2] };
+	};
+};
+
+struct LodLevel
+{
+	ind_buf_id indId;
+	float error = 0.f;		// object-space geometric error
 };
 
 struct DrawParams
 {
+	// either an interleaved vertex buffer, or one buffer per attribute
+	vtx_buf_id vtxId;
 	pos_buf_id posId;
 	ind_buf_id indId;
 	col_buf_id colId;
@@ -97,62 +189,285 @@ struct DrawParams
 	uv_buf_id uvId;
 	bone_weight_buf_id boneWeightId;
 
+	// lods[0] is the full mesh, empty when the mesh has no lod chain
+	std::vector<LodLevel> lods;
+	Vector3f boundCenter;		// object-space bounding sphere
+	float boundRadius = 0.f;
+
 	// anim
 	std::vector<Matrix4f> boneTransform;		// bone id -> transform
 
+	// the coarsest rate this draw allows, the screen tiles may lower it
+	ShadingRate shadingRate = ShadingRate::Rate1x1;
+
+	// points: side of the square splat in pixels, up to Renderer::POINT_TILE_SIZE, and the [0, 1] color
+	// of the points without a color buffer
+	int pointSize = 1;
+	Vector4f pointColor{ 1.f, 0.f, 0.f, 1.f };
+
 	VertexShaderParams vsParams;
 	FragmentShaderParams fsParams;
 	Primitive type;
 };
 
+// vertex data of every mesh, can be shared by several renderers (e.g. shadow maps)
+struct BufferStore
+{
+	SlotMap<VertexBuffer, vtx_buf_id> vertexBufs;
+	SlotMap<std::vector<Vector3f>, pos_buf_id> posBufs;
+	SlotMap<IndexBuffer, ind_buf_id> indBufs;
+	SlotMap<std::vector<Vector4f>, col_buf_id> colorBufs;
+	SlotMap<std::vector<Vector3f>, nor_buf_id> normalBufs;
+	SlotMap<std::vector<Vector2f>, uv_buf_id> uvBufs;
+
+	// posId -> {boneid, weight}
+	SlotMap<std::vector<std::vector<std::pair<int, float>>>, bone_weight_buf_id> boneWeightBufs;
+};
+
+// pixels [x0, x1] x [y0, y1] from the left-bottom, empty when x1 < x0 or y1 < y0
+struct ScreenRect
+{
+	int x0 = 0;
+	int y0 = 0;
+	int x1 = -1;
+	int y1 = -1;
+
+	bool empty() const { return x1 < x0 || y1 < y0; };
+	static ScreenRect merge(const ScreenRect& a, const ScreenRect& b);
+	static ScreenRect intersect(const ScreenRect& a, const ScreenRect& b);
+};
+
+// per-triangle constants of the rasterizer, computed once so the per-pixel work is multiply-adds
+struct TriangleSetup
+{
+	Vector4f portPos[3];
+
+	// edge function k is zero on the edge opposite to vertex k, barycentric k = edge k * invArea
+	float edgeX[3], edgeY[3];		// a point of the edge
+	float edgeDx[3], edgeDy[3];		// screen gradient
+	float invArea;
+
+	// 1/w and varying/w are affine in screen space: value at vertex 0, d/dx, d/dy
+	float invW[3];
+	float varyings[MAX_VARYINGS][3];
+	int varyingCount = 0;
+
+	// false for a triangle without area
+	bool setup(const Vector4f* pos);
+	// varyings stored SoA, varying v of vertex i at [v * stride + i]
+	void setupVaryings(const float* varyingBuf, int stride, const int* indices, int count);
+	// false outside the triangle
+	bool getBarycentricCoord(float x, float y, Vector3f& barycentricCoord) const;
+	// perspective-correct varyings at (x, y), one reciprocal for all of them
+	void interpolate(float x, float y, float* out) const;
+	// d/dx and d/dy of varying v at (x, y)
+	void getDerivatives(float x, float y, int v, float& dx, float& dy) const;
+	// the farthest depth of the triangle's plane over the pixel, not beyond its farthest vertex
+	float getFarthestDepth(int x, int y) const;
+};
+
+// the points of a buffer or of a point cloud chunk, numbered from first among the points of the draw
+struct PointSource
+{
+	const float* positions = nullptr;
+	int stride = 3;						// floats from a position to the next
+	const Vector4f* colors = nullptr;	// nullptr for DrawParams::pointColor
+	const std::vector<std::vector<std::pair<int, float>>>* boneWeights = nullptr;
+	int count = 0;
+	int first = 0;
+};
+
+// a point on screen, its square goes from (x, y) - (size - 1) / 2 over size pixels
+struct PointSplat
+{
+	int16_t x, y;
+	float z;
+	Uint32 color;			// 8 bit rgb
+};
+
 class Renderer
 {
+public:
+	static const int POINT_TILE_SIZE = 64;
+
 private:
 	Texture renderTexture;							// renderTexture, framebuf
-	std::map<int, std::vector<Vector3f>> posBufs;
-	std::map<int, std::vector<Vector3i>> indBufs;
-	std::map<int, std::vector<Vector4f>> colorBufs;
-	std::map<int, std::vector<Vector3f>> normalBufs;
-	std::map<int, std::vector<Vector2f>> uvBufs;
+	std::shared_ptr<BufferStore> buffers;
+
+	DepthBuffer depthBuffer;
+	int width = 0;
+	int height = 0;
+	RenderPass renderPass = RenderPass::Color;
+
+	// msaa, every pixel keeps sampleCount depths in depthBuffer and, with more than one sample, colors in sampleColors
+	int sampleCount = 1;
+	std::vector<Vector2f> sampleOffsets;		// from the left-bottom corner of the pixel
+	std::vector<Uint32> sampleColors;			// packed argb, rgb9e5 with hdr
+	// per DepthBuffer::TILE_SIZE tile of sampleColors, holds clearSampleColor until first written
+	std::vector<unsigned char> colorTileCleared;
+	Uint32 clearSampleColor = 0;
 
-	// bufid -> map{ posId -> {boneid, weight} }
-	std::map<int, std::vector<std::vector<std::pair<int, float>>>> boneWeightBufs;
+	// shade into hdrTarget instead of renderTexture, 255 from the fragment shader is 1.0 there
+	bool hdr = false;
+	HdrImage hdrTarget;
 
-	std::vector<float> zBuf;
+	// post-transform buffers of the current draw
+	std::vector<Vector4f> portPosBuf;
+	std::vector<Vector4f> viewPosBuf;
+	std::vector<float> varyingBuf;				// SoA, varying v of vertex i at [v * vertex count + i]
 	
 	std::function<Vector4f(VertexShaderParams&)> pfVertexShader;
+	int varyingCount = 0;
 	std::function<Vector4f(FragmentShaderParams&)> pfFragmentShader;
+
+	float lodErrorThreshold = 1.0f;				// in pixels
+
+	// light culling, tile -> [lightTileOffsets[tile], lightTileOffsets[tile + 1]) in lightTileIndices
+	static const int LIGHT_TILE_SIZE = 16;
+	int lightTileCols = 0;
+	int lightTileRows = 0;
+	std::vector<int> lightTileOffsets;
+	std::vector<int> lightTileIndices;
+	std::vector<Light> tiledLights;				// the lights the tiles were built for
+	Matrix4f tiledProjection;
+
+	// variable rate shading, per light tile, from the luminance of the previous frame
+	bool variableRateShading = false;
+	std::vector<ShadingRate> tileShadingRates;
+
+	// depth-only passes: a covered pixel gets the farthest depth of the triangle over its area
+	bool conservativeDepth = false;
+
+	// clears, draws and resolve only touch these pixels
+	bool hasScissor = false;
+	ScreenRect scissor;
+
+	// point draws: jobs of consecutive points project them and sort the splats by the screen tile of their
+	// lower left pixel, then every tile is drawn by one thread from its bins and those of its left and lower
+	// neighbours, in job order. no two threads touch a pixel and the result does not depend on the threads
+	static const int POINTS_PER_JOB = 4096;
+	static const int MAX_POINT_JOBS = 64;
+	std::vector<PointSource> pointSources;
+	std::vector<float> pointPositions;			// compact positions of drawPoint, unpacked
+	std::vector<PointSplat> pointSplats;		// the splats of job j in the range of its points, by tile
+	std::vector<PointSplat> unsortedSplats;
+	std::vector<int> splatTiles;				// of unsortedSplats
+	std::vector<int> pointBinOffsets;			// job j, tile t at j * (tile count + 1) + t, into the job's range
+
+	// splits the point draws, nullptr for the calling thread alone
+	std::shared_ptr<WorkerPool> workers;
+
+	template<typename Func>
+	void parallelFor(int count, Func& func, int bandSize = 0)
+	{
+		if (workers)
+			workers->parallelFor(count, func, bandSize);
+		else if (count > 0)
+			func(0, count);
+	};
 	
-	int bufId = 1;
-	int getNextId() { return bufId++; };	 // from 1 ~
-	void drawPoint(DrawParams param);
-	void drawTriangle(DrawParams param);
+	void drawPoint(DrawParams& param);
+	void drawPoints(const DrawParams& param);
+	void drawTriangle(DrawParams& param);
+	void drawTriangleDepth(DrawParams& param);
+	bool processVertices(DrawParams& param, bool withVaryings);
+	bool getTriangleBounds(const Vector4f* portPos, int bounds[4]);
+	float interpolateDepth(const Vector3f& barycentricCoord, const Vector4f* portPos);
+	unsigned int coverSamples(int x, int y, const TriangleSetup& tri, bool equalDepth, Vector2f& shadePos);
+	void writeSamples(int x, int y, unsigned int mask, const Vector4f& col);
+	Uint32* getSampleColors(int x, int y);
+	void fillColorTile(int tile);
+	int getShadingRate(ShadingRate drawRate, int tile) const;
+	static Uint32 packColor(const Vector4f& col);
+	Uint32 packSample(const Vector4f& col) const;
+	static Uint32 packRgb9e5(float r, float g, float b);
+	static void unpackRgb9e5(Uint32 packed, float rgb[3]);
+	int selectLod(const DrawParams& param);
+	void updateLightTiles(const std::vector<Light>& lights, const Matrix4f& projection, float zNear);
+	bool getSphereScreenRect(const Vector3f& c, float r, const Matrix4f& projection, float zNear, float rect[4]);
+	bool isOutsideScissor(const DrawParams& param);
+	ScreenRect getDrawArea() const;
 
 	int getIndex(int x, int y);
-	bool isInside(float x, float y, const Vector4f* triPos);
 	bool isBackFace(const Vector4f* triPos);
-	Vector3f getBarycentricCoord(float x, float y, const Vector4f* triPos);
 
 public:
-	Renderer() {};
+	Renderer() : buffers(std::make_shared<BufferStore>()) {};
 	Renderer(SDL_Surface *src);
+	Renderer(int w, int h);				// depth only, no color target
+
+	// draw the buffers added to another renderer
+	void shareBuffers(const Renderer& other) { buffers = other.buffers; };
 	
 	pos_buf_id addPositionBuf(std::vector<Vector3f>&& posBuf);
+	// stored 16-bit when the indices fit
 	ind_buf_id addIndexBuf(std::vector<Vector3i>&& indBuf);
 	col_buf_id addColorBuf(std::vector<Vector4f>&& colorBuf);
 	nor_buf_id addNormalBuf(std::vector<Vector3f>&& normalBuf);
 	uv_buf_id  addUVBuf(std::vector<Vector2f>&& uvBuf);
 	bone_weight_buf_id addBoneWeightBuf(std::vector<std::vector<std::pair<int, float>>>&& boneWeightBuf);
+	vtx_buf_id addVertexBuf(std::vector<float>&& data, const VertexLayout& layout);
+
+	// frees the memory, draws still using the handle are skipped
+	void releaseBuf(pos_buf_id id) { buffers->posBufs.erase(id); };
+	void releaseBuf(ind_buf_id id) { buffers->indBufs.erase(id); };
+	void releaseBuf(col_buf_id id) { buffers->colorBufs.erase(id); };
+	void releaseBuf(nor_buf_id id) { buffers->normalBufs.erase(id); };
+	void releaseBuf(uv_buf_id id) { buffers->uvBufs.erase(id); };
+	void releaseBuf(bone_weight_buf_id id) { buffers->boneWeightBufs.erase(id); };
+	void releaseBuf(vtx_buf_id id) { buffers->vertexBufs.erase(id); };
 
+	// with msaa only the samples are cleared, the target gets the clear color from resolve()
 	void clearColor(const Vector4f& col);
+	// flags the depth tiles, o(tiles)
 	void clearZ();
+	// reallocates the depth buffer, D32F by default
+	void setDepthFormat(DepthFormat format);
+	DepthFormat getDepthFormat() const { return depthBuffer.getFormat(); };
 
-	void setVertexShader(std::function<Vector4f(VertexShaderParams&)>);
+	// 1, 4 or 8 samples per pixel, the fragment shader still runs once per pixel and triangle
+	void setSampleCount(int samples);
+	int getSampleCount() const { return sampleCount; };
+	// average the samples into the render texture, call it once the frame is drawn
+	void resolve();
+	// float color target for post processing (see PostChain), the render texture is left alone
+	void setHdr(bool enable);
+	bool isHdr() const { return hdr; };
+	const HdrImage& getHdrTarget() const { return hdrTarget; };
+
+	// varyingCount : how many of VertexShaderParams::varyings the shader writes, only those are kept and interpolated
+	void setVertexShader(std::function<Vector4f(VertexShaderParams&)>, int varyingCount = 0);
+	int getVaryingCount() const { return varyingCount; };
 	void setFragmentShader(std::function<Vector4f(FragmentShaderParams&)>);
+	const std::function<Vector4f(VertexShaderParams&)>& getVertexShader() const { return pfVertexShader; };
+	const std::function<Vector4f(FragmentShaderParams&)>& getFragmentShader() const { return pfFragmentShader; };
+	void setLodErrorThreshold(float pixels) { lodErrorThreshold = pixels; };
+	void setRenderPass(RenderPass pass) { renderPass = pass; };
+	// off: every pixel is shaded, whatever DrawParams::shadingRate says
+	void setVariableRateShading(bool enable) { variableRateShading = enable; };
+	// pick the rate of every tile from the luminance variance of the resolved frame, for the next one
+	void updateShadingRates();
+	// for occluders, what is behind the written depth is behind the triangle anywhere in the pixel
+	void setConservativeDepth(bool enable) { conservativeDepth = enable; };
+	// limit the clears, draws and resolve to rect, e.g. to redraw only what changed on screen
+	void setScissor(const ScreenRect& rect);
+	void disableScissor() { hasScissor = false; };
+
+	// threads for the point draws, the caller keeps the pool to itself while it draws
+	void setWorkerPool(std::shared_ptr<WorkerPool> pool) { workers = std::move(pool); };
 
 	void setColor(int x, int y, const Vector4f& col);
 	void draw(DrawParams &param);
+	// the chunks of cloud whose bounds intersect the frustum, as points with the matrices, size and color of param
+	void drawPointCloud(const PointCloud& cloud, DrawParams& param);
     Texture& getRenderTexture() { return renderTexture; };
+	// draw into another texture of the same size, shares its surface
+	void setRenderTarget(const Texture& target) { renderTexture = target; };
+	// render into the w x h top-left part of the target, at most the size of the target
+	void setResolution(int w, int h);
+	float getDepth(int x, int y) const;		// from left-bottom, first sample
+	int getWidth() const { return width; };
+	int getHeight() const { return height; };
 };
 
 #endif
\ No newline at end of file
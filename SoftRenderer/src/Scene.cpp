@@ -0,0 +1,108 @@
+#include "Scene.h"
+#include "FrameArena.h"
+#include <cmath>
+
+int Scene::addNode(int parent)
+{
+	int idx = static_cast<int>(nodes.size());
+	nodes.emplace_back();
+	nodes[idx].parent = parent;
+	if (parent != -1)
+		nodes[parent].children.push_back(idx);
+	markDirty(idx);
+	return idx;
+}
+
+void Scene::setLocalTransform(int node, const Matrix4f& local)
+{
+	nodes[node].local = local;
+	markDirty(node);
+}
+
+void Scene::setBounds(int node, const Vector3f& center, float radius)
+{
+	auto& n = nodes[node];
+	n.hasBounds = true;
+	n.bounds.min = Vector3f(center.x - radius, center.y - radius, center.z - radius);
+	n.bounds.max = Vector3f(center.x + radius, center.y + radius, center.z + radius);
+	markDirty(node);
+}
+
+void Scene::markDirty(int node)
+{
+	if (!nodes[node].dirty)
+	{
+		nodes[node].dirty = true;
+		dirtyNodes.push_back(node);
+	}
+}
+
+void Scene::update()
+{
+	for (int node : dirtyNodes)
+	{
+		if (!nodes[node].dirty)
+			continue;
+
+		// start from the top-most dirty ancestor so every node is updated once, after its parent
+		int top = node;
+		for (int p = nodes[node].parent; p != -1; p = nodes[p].parent)
+		{
+			if (nodes[p].dirty)
+				top = p;
+		}
+		updateSubtree(top);
+	}
+	dirtyNodes.clear();
+}
+
+void Scene::updateSubtree(int root)
+{
+	FrameVector<int> stack = { root };
+	while (!stack.empty())
+	{
+		int idx = stack.back();
+		stack.pop_back();
+
+		auto& node = nodes[idx];
+		node.world = node.parent == -1 ? node.local : nodes[node.parent].world * node.local;
+		node.worldInverseT = node.world.inverse().transpose();
+		node.dirty = false;
+
+		if (node.hasBounds)
+		{
+			auto box = getWorldBounds(node);
+			if (node.proxy == -1)
+				node.proxy = bvh.insert(box, idx);
+			else
+				bvh.move(node.proxy, box);
+		}
+
+		for (int child : node.children)
+			stack.push_back(child);
+	}
+}
+
+// the box around the transformed object-space box: center transformed, extents by |world|
+Aabb Scene::getWorldBounds(const Node& node) const
+{
+	const auto& m = node.world.num;
+	auto center = 0.5f * (node.bounds.min + node.bounds.max);
+	auto extent = 0.5f * (node.bounds.max - node.bounds.min);
+	auto c = node.world * Vector4f{ center.x, center.y, center.z, 1.f };
+
+	Vector3f e(
+		std::abs(m[0]) * extent.x + std::abs(m[1]) * extent.y + std::abs(m[2]) * extent.z,
+		std::abs(m[4]) * extent.x + std::abs(m[5]) * extent.y + std::abs(m[6]) * extent.z,
+		std::abs(m[8]) * extent.x + std::abs(m[9]) * extent.y + std::abs(m[10]) * extent.z);
+
+	Aabb res;
+	res.min = Vector3f(c.x - e.x, c.y - e.y, c.z - e.z);
+	res.max = Vector3f(c.x + e.x, c.y + e.y, c.z + e.z);
+	return res;
+}
+
+void Scene::queryFrustum(const Matrix4f& viewProj, std::vector<int>& result) const
+{
+	bvh.queryFrustum(Frustum::fromMatrix(viewProj), result);
+}
\ No newline at end of file
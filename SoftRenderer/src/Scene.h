@@ -0,0 +1,63 @@
+#ifndef M_SCENE_H
+#define M_SCENE_H
+
+#include "Math.h"
+#include "DynamicBvh.h"
+#include <vector>
+
+// hierarchy of transforms. world transforms are cached and only recomputed below the nodes whose
+// local transform changed, nodes with bounds are kept in a bvh that is refitted for the ones that moved.
+class Scene
+{
+public:
+	// returns the id of the node, parent -1 for a root
+	int addNode(int parent = -1);
+	void setLocalTransform(int node, const Matrix4f& local);
+	// object-space sphere around what the node draws, the node is then found by the queries
+	void setBounds(int node, const Vector3f& center, float radius);
+	// the application's payload, e.g. the index of a mesh
+	void setUserData(int node, int data) { nodes[node].userData = data; };
+	int getUserData(int node) const { return nodes[node].userData; };
+	// large nodes that hide others, drawn first into the occlusion depth
+	void setOccluder(int node, bool occluder) { nodes[node].occluder = occluder; };
+	bool isOccluder(int node) const { return nodes[node].occluder; };
+	const Aabb& getBounds(int node) const { return nodes[node].bounds; };
+
+	// valid after update()
+	const Matrix4f& getWorldTransform(int node) const { return nodes[node].world; };
+	const Matrix4f& getNormalTransform(int node) const { return nodes[node].worldInverseT; };
+
+	// propagates the dirty transforms and refits the bvh
+	void update();
+
+	// nodes whose bounds may be visible, viewProj : projection * view
+	void queryFrustum(const Matrix4f& viewProj, std::vector<int>& result) const;
+	const DynamicBvh& getBvh() const { return bvh; };
+
+private:
+	struct Node
+	{
+		int parent = -1;
+		std::vector<int> children;
+		Matrix4f local = Matrix4f::Identity();
+		Matrix4f world = Matrix4f::Identity();
+		Matrix4f worldInverseT = Matrix4f::Identity();		// world.inverse().transpose(), for normals
+		bool dirty = false;			// in dirtyNodes, world is stale
+
+		bool hasBounds = false;
+		Aabb bounds;			// object space
+		int proxy = -1;			// leaf in the bvh
+		int userData = -1;
+		bool occluder = false;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<int> dirtyNodes;
+	DynamicBvh bvh;
+
+	void markDirty(int node);
+	void updateSubtree(int node);
+	Aabb getWorldBounds(const Node& node) const;
+};
+
+#endif
\ No newline at end of file
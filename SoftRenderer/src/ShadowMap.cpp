@@ -0,0 +1,68 @@
+#include "ShadowMap.h"
+#include <limits>
+
+ShadowMap::ShadowMap(const Renderer& source, int size, float fov, float zNear, float zFar) 
+	: source(source), renderer(size, size), fov(fov), zNear(zNear), zFar(zFar)
+{
+	renderer.shareBuffers(source);
+	renderer.setRenderPass(RenderPass::DepthOnly);
+	lightProj = MathUtility::getPerspctiveMatrix(fov * PI / 180.f, 1.f, zNear, zFar);
+	lightView = Matrix4f::Identity();
+}
+
+void ShadowMap::begin(const Light& light, const Vector3f& target)
+{
+	lightView = MathUtility::lookAt(light.position, target, Vector3f{ 0, 1, 0 });
+	renderer.setVertexShader(source.getVertexShader());
+	renderer.clearZ();
+}
+
+void ShadowMap::draw(DrawParams& param)
+{
+	auto vsp = param.vsParams;
+
+	param.vsParams.mv = lightView * vsp.mv;
+	param.vsParams.p = lightProj;
+	param.vsParams.zNear = zNear;
+	param.vsParams.zFar = zFar;
+	renderer.draw(param);
+
+	param.vsParams = vsp;
+}
+
+float ShadowMap::visibility(const Vector3f& viewPos) const
+{
+	auto lightPos = lightView * Vector4f{ viewPos.x, viewPos.y, viewPos.z, 1.f };
+	auto clip = lightProj * lightPos;
+	if (clip.w >= 0.f)
+		return 1.f;		// behind the light
+
+	// the same mapping as Renderer::processVertices
+	float x = (clip.x / clip.w + 1.f) / 2 * renderer.getWidth() - 0.5f;
+	float y = (clip.y / clip.w + 1.f) / 2 * renderer.getHeight() - 0.5f;
+	float dist = -lightPos.z;
+
+	int x0 = static_cast<int>(std::floor(x));
+	int y0 = static_cast<int>(std::floor(y));
+	float lit = 0.f;
+	for (int k = 0; k < 4; ++k)
+	{
+		int i = MathUtility::clamp(x0 + (k & 1), 0, renderer.getWidth() - 1);
+		int j = MathUtility::clamp(y0 + (k >> 1), 0, renderer.getHeight() - 1);
+		if (dist <= linearDepth(renderer.getDepth(i, j)) + bias)
+			lit += 0.25f;
+	}
+	return lit;
+}
+
+// depth value -> distance from the light, inverse of the mapping in Renderer::processVertices
+float ShadowMap::linearDepth(float z) const
+{
+	// cleared texel, nothing drawn there
+	if (z <= 0.f)
+		return std::numeric_limits<float>::max();
+
+	float ndc = (z - (zFar + zNear) / 2) / ((zFar - zNear) / 2);
+	// ndc = p[10] + p[11] / viewZ
+	return -lightProj.num[11] / (ndc - lightProj.num[10]);
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef M_SHADOW_MAP_H
+#define M_SHADOW_MAP_H
+
+#include "Math.h"
+#include "Renderer.h"
+#include "Light.h"
+
+// depth rendered from a light's point of view, the light looks at a target like a spot light.
+class ShadowMap
+{
+public:
+	// draws the meshes added to source
+	ShadowMap(const Renderer& source, int size = 512, float fov = 90.f, float zNear = 0.1f, float zFar = 100.f);
+
+	// light and target in view space, clears the depth and picks up the vertex shader of source
+	void begin(const Light& light, const Vector3f& target);
+	// depth-only draw of a mesh whose vsParams are set up for the camera
+	void draw(DrawParams& param);
+
+	// camera view space -> light clip space, valid after begin(), for culling the casters
+	Matrix4f getViewProjection() const { return lightProj * lightView; };
+
+	// 1 if the view-space point is lit, 0 if it is in shadow, 2x2 pcf in between
+	float visibility(const Vector3f& viewPos) const;
+
+	float bias = 0.05f;			// in distance from the light, against self-shadowing acne
+
+private:
+	const Renderer& source;
+	Renderer renderer;
+	Matrix4f lightView;			// camera view space -> light view space
+	Matrix4f lightProj;
+	float fov;
+	float zNear;
+	float zFar;
+
+	float linearDepth(float z) const;
+};
+
+#endif
\ No newline at end of file
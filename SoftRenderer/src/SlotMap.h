@@ -0,0 +1,73 @@
+#ifndef M_SLOT_MAP_H
+#define M_SLOT_MAP_H
+
+#include <vector>
+
+// dense storage addressed by generational handles: O(1) lookup, released slots are reused,
+// and the generation makes a handle to a released slot resolve to nullptr instead of its new occupant.
+// Handle : any struct with int id and unsigned int generation, a default one (generation 0) never resolves
+template<typename T, typename Handle>
+class SlotMap
+{
+public:
+	Handle insert(T&& value)
+	{
+		int idx;
+		if (!freeSlots.empty())
+		{
+			idx = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			idx = static_cast<int>(slots.size());
+			slots.emplace_back();
+		}
+
+		auto& slot = slots[idx];
+		slot.value = std::move(value);
+		slot.alive = true;
+
+		Handle handle;
+		handle.id = idx;
+		handle.generation = slot.generation;
+		return handle;
+	}
+
+	T* get(const Handle& handle)
+	{
+		if (handle.id < 0 || handle.id >= static_cast<int>(slots.size()))
+			return nullptr;
+		auto& slot = slots[handle.id];
+		return slot.alive && slot.generation == handle.generation ? &slot.value : nullptr;
+	}
+
+	// frees the memory of the value, false if the handle was already stale
+	bool erase(const Handle& handle)
+	{
+		if (get(handle) == nullptr)
+			return false;
+
+		auto& slot = slots[handle.id];
+		slot.value = T();
+		slot.alive = false;
+		++slot.generation;
+		freeSlots.push_back(handle.id);
+		return true;
+	}
+
+	int size() const { return static_cast<int>(slots.size() - freeSlots.size()); };
+
+private:
+	struct Slot
+	{
+		T value;
+		unsigned int generation = 1;
+		bool alive = false;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<int> freeSlots;
+};
+
+#endif
\ No newline at end of file
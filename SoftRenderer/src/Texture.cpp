@@ -37,9 +37,9 @@ Texture::Texture(const char* filepath)
 }
 
 
-Texture::Texture(SDL_RWops* stream)
+Texture::Texture(SDL_RWops* stream, const char* type)
 {
-	SDL_Surface* tsurface = IMG_Load_RW(stream, 0);
+	SDL_Surface* tsurface = IMG_LoadTyped_RW(stream, 0, type);
 	if (tsurface == NULL)
 	{
 		printf("Texture create from memory fail.");
@@ -60,7 +60,7 @@ Texture::Texture(const Texture& rhs)
 	if (this != &rhs)
 	{
 		this->width = rhs.width;
-		this->height = rhs.width;
+		this->height = rhs.height;
 		this->surface = rhs.surface;
 	}
 }
@@ -70,7 +70,7 @@ Texture& Texture::operator=(const Texture& rhs)
 	if (this != &rhs)
 	{
 		this->width = rhs.width;
-		this->height = rhs.width;
+		this->height = rhs.height;
 		this->surface = rhs.surface;
 	}
 
@@ -181,3 +181,21 @@ void Texture::clear(const Vector4f& color)
 		std::fill_n(pixels, surface->w * surface->h, mapCol);
 	}
 }
+
+void Texture::clear(const Vector4f& color, int x, int y, int w, int h)
+{
+	if (surface != NULL)
+	{
+		auto mapCol = SDL_MapRGBA(surface->format,
+			MathUtility::clamp(color.x, 0.f, 255.0f),
+			MathUtility::clamp(color.y, 0.f, 255.0f),
+			MathUtility::clamp(color.z, 0.f, 255.0f),
+			MathUtility::clamp(color.w, 0.f, 255.0f)
+		);
+		for (int row = y; row < y + h; ++row)
+		{
+			Uint32* pixels = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surface->pixels) + row * surface->pitch);
+			std::fill_n(pixels + x, w, mapCol);
+		}
+	}
+}
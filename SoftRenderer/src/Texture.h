@@ -15,7 +15,8 @@ public:
 	Texture() : width(0), height(0), surface(NULL) {};
 	Texture(SDL_Surface* src);			// create a new one from a exact surface
 	Texture(const char* filepath);		// load from file
-	Texture(SDL_RWops* stream);			// load from memory
+	// load from memory, type : the extension of formats without magic bytes like "tga", nullptr if none
+	Texture(SDL_RWops* stream, const char* type = nullptr);
 
 	// just move
 	Texture(const Texture& rhs);
@@ -28,6 +29,8 @@ public:
 	Vector4f getColorFromUV(const float u, const float v) const;
 	void setColor(const int x, const int y, const Vector4f& color);
 	void clear(const Vector4f& color);
+	// the w x h rect at (x, y) from the left-top
+	void clear(const Vector4f& color, int x, int y, int w, int h);
 
 	SDL_Surface* getRawSurface() { return surface.get(); };
 
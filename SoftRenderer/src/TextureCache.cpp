@@ -0,0 +1,121 @@
+#include "TextureCache.h"
+#include "DirtyRegion.h"
+#include <fstream>
+#include <vector>
+
+TextureCache& TextureCache::global()
+{
+	static TextureCache cache;
+	return cache;
+}
+
+std::shared_ptr<Texture> TextureCache::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		printf("Could not open the texture %s!\n", path.c_str());
+		return nullptr;
+	}
+	std::vector<char> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	if (!file.read(data.data(), data.size()))
+	{
+		printf("Could not read the texture %s!\n", path.c_str());
+		return nullptr;
+	}
+	// the decoder tells most formats from their first bytes, the others only from the extension
+	auto dot = path.find_last_of('.');
+	auto slash = path.find_last_of("/\\");
+	bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+	auto type = hasExtension ? path.substr(dot + 1) : std::string();
+	return load(data.data(), data.size(), type.empty() ? nullptr : type.c_str());
+}
+
+std::shared_ptr<Texture> TextureCache::load(const void* data, size_t size, const char* type)
+{
+	// seeded with the size so images of different sizes never share a key
+	uint64_t key = DirtyRegion::hash(data, size, 14695981039346656037ull ^ size);
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = entries.find(key);
+		if (it != entries.end() && it->second.holds(data, size))
+		{
+			it->second.lastUsed = ++useCounter;
+			return it->second.texture;
+		}
+	}
+
+	// decoded outside the lock, two threads decoding the same image keep the first one
+	auto stream = SDL_RWFromConstMem(data, static_cast<int>(size));
+	if (stream == NULL)
+	{
+		printf("Could not read a texture from memory! SDL_Error: %s\n", SDL_GetError());
+		return nullptr;
+	}
+	auto texture = std::make_shared<Texture>(stream, type);
+	SDL_RWclose(stream);
+	if (texture->getRawSurface() == nullptr)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto inserted = entries.try_emplace(key);
+	auto& entry = inserted.first->second;
+	// another image with the same hash keeps the entry, this one is not cached
+	if (!inserted.second && !entry.holds(data, size))
+		return texture;
+	entry.lastUsed = ++useCounter;
+	if (inserted.second)
+	{
+		entry.texture = texture;
+		auto bytes = static_cast<const unsigned char*>(data);
+		entry.encoded.assign(bytes, bytes + size);
+		entry.bytes = static_cast<size_t>(texture->getRawSurface()->pitch) * texture->height + size;
+		usage += entry.bytes;
+		evict(capacity);
+	}
+	return entry.texture;
+}
+
+void TextureCache::setCapacity(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	capacity = bytes;
+	evict(capacity);
+}
+
+void TextureCache::trim(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	evict(bytes);
+}
+
+size_t TextureCache::getMemoryUsage() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return usage;
+}
+
+int TextureCache::getEntryCount() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return static_cast<int>(entries.size());
+}
+
+// the textures held elsewhere stay whatever the memory, so it can remain over bytes
+void TextureCache::evict(size_t bytes)
+{
+	while (usage > bytes)
+	{
+		auto victim = entries.end();
+		for (auto it = entries.begin(); it != entries.end(); ++it)
+		{
+			if (it->second.texture.use_count() == 1 && (victim == entries.end() || it->second.lastUsed < victim->second.lastUsed))
+				victim = it;
+		}
+		if (victim == entries.end())
+			return;
+		usage -= victim->second.bytes;
+		entries.erase(victim);
+	}
+}
\ No newline at end of file
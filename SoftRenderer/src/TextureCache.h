@@ -0,0 +1,65 @@
+#ifndef M_TEXTURE_CACHE_H
+#define M_TEXTURE_CACHE_H
+
+#include "Texture.h"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// decoded textures keyed by a hash of their encoded bytes, so the same image decodes once however many
+// models or renderers use it and under whatever path. a texture is held through its shared_ptr, the cache
+// keeps one reference of its own: entries nobody else holds stay for a reload until the memory goes over
+// the capacity, then they go least recently used first. thread-safe
+class TextureCache
+{
+public:
+	static const size_t DEFAULT_CAPACITY = 256 << 20;
+
+	// the one shared by the whole process
+	static TextureCache& global();
+
+	explicit TextureCache(size_t capacityBytes = DEFAULT_CAPACITY) : capacity(capacityBytes) {};
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	// nullptr when the file can't be read or decoded
+	std::shared_ptr<Texture> load(const std::string& path);
+	// an encoded image in memory, e.g. embedded in a model file.
+	// type : the extension of the format, needed for those without magic bytes like tga, nullptr if unknown
+	std::shared_ptr<Texture> load(const void* data, size_t size, const char* type = nullptr);
+
+	void setCapacity(size_t bytes);
+	// drops the entries nobody holds until the memory is under bytes, trim(0) drops all of them
+	void trim(size_t bytes);
+
+	size_t getMemoryUsage() const;
+	int getEntryCount() const;
+
+private:
+	struct Entry
+	{
+		std::shared_ptr<Texture> texture;
+		std::vector<unsigned char> encoded;		// compared on a hit, two images may share a hash
+		size_t bytes = 0;			// of the decoded pixels and the encoded ones
+		uint64_t lastUsed = 0;
+
+		bool holds(const void* data, size_t size) const
+		{
+			return encoded.size() == size && std::memcmp(encoded.data(), data, size) == 0;
+		};
+	};
+
+	std::unordered_map<uint64_t, Entry> entries;
+	size_t capacity;
+	size_t usage = 0;
+	uint64_t useCounter = 0;
+	mutable std::mutex mtx;
+
+	void evict(size_t bytes);		// mtx is held
+};
+
+#endif
\ No newline at end of file
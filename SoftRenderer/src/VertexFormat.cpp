@@ -0,0 +1,244 @@
+#include "VertexFormat.h"
+#include <algorithm>
+#include <cassert>
+
+#ifdef _DEBUG
+// every vertex fetched back from data against its source, within the step of its format
+static void checkInterleaved(const std::vector<Vector3f>& positions,
+	const std::vector<Vector3f>& normals,
+	const std::vector<Vector2f>& uvs,
+	const VertexLayout& layout,
+	const std::vector<float>& data)
+{
+	for (int i = 0; i < static_cast<int>(positions.size()); ++i)
+	{
+		const float* v = &data[static_cast<size_t>(i) * layout.stride];
+
+		Vector4f p = VertexFormat::fetchPosition(v, layout);
+		const auto& source = positions[i];
+		if (layout.positionFormat == PositionFormat::Float3)
+		{
+			assert(p.x == source.x && p.y == source.y && p.z == source.z);
+		}
+		else
+		{
+			// half a step of the box, and the rounding of bias + q * scale
+			auto close = [](float fetched, float expected, float bias, float scale) {
+				float extent = std::fabs(bias) + 65535.f * scale;
+				return std::fabs(fetched - expected) <= 0.5f * scale + 1e-5f * std::max(extent, 1.f);
+			};
+			const auto& bias = layout.positionBias;
+			const auto& scale = layout.positionScale;
+			assert(close(p.x, source.x, bias.x, scale.x) && close(p.y, source.y, bias.y, scale.y)
+				&& close(p.z, source.z, bias.z, scale.z));
+			(void)close;
+		}
+
+		if (layout.normalOffset >= 0)
+		{
+			Vector3f n = VertexFormat::fetchNormal(v, layout);
+			if (layout.normalFormat == NormalFormat::Float3)
+				assert(n.x == normals[i].x && n.y == normals[i].y && n.z == normals[i].z);
+			else if (normals[i].length() > 1e-6f)
+				assert(n.dotProduct(normals[i].normalize()) >= (layout.normalFormat == NormalFormat::Oct16 ? 0.99f : 0.9999f));
+		}
+
+		if (layout.uvOffset >= 0)
+		{
+			Vector2f uv = VertexFormat::fetchUv(v, layout);
+			if (layout.uvFormat == UvFormat::Float2)
+			{
+				assert(uv.x == uvs[i].x && uv.y == uvs[i].y);
+			}
+			else
+			{
+				// 11 bits of mantissa, subnormal below 2^-14
+				auto close = [](float fetched, float expected) {
+					return std::fabs(fetched - expected) <= std::fabs(expected) * (1.f / 2048.f) + 1.f / 16777216.f;
+				};
+				assert(close(uv.x, uvs[i].x) && close(uv.y, uvs[i].y));
+				(void)close;
+			}
+		}
+	}
+}
+#endif
+
+void VertexFormat::interleave(const std::vector<Vector3f>& positions,
+	const std::vector<Vector3f>& normals,
+	const std::vector<Vector2f>& uvs,
+	VertexLayout& layout,
+	std::vector<float>& data)
+{
+	int count = static_cast<int>(positions.size());
+	bool hasNormals = !normals.empty() && static_cast<int>(normals.size()) >= count;
+	bool hasUvs = !uvs.empty() && static_cast<int>(uvs.size()) >= count;
+
+	int stride = 0;
+	layout.positionOffset = stride;
+	stride += layout.positionFormat == PositionFormat::Float3 ? 3 : 2;
+	layout.normalOffset = -1;
+	if (hasNormals)
+	{
+		if (layout.normalFormat == NormalFormat::Float3)
+		{
+			layout.normalOffset = stride;
+			stride += 3;
+		}
+		else if (layout.normalFormat == NormalFormat::Oct16 && layout.positionFormat == PositionFormat::Unorm16)
+		{
+			layout.normalOffset = layout.positionOffset + 1;
+		}
+		else
+		{
+			layout.normalOffset = stride;
+			stride += 1;
+		}
+	}
+	layout.uvOffset = -1;
+	if (hasUvs)
+	{
+		layout.uvOffset = stride;
+		stride += layout.uvFormat == UvFormat::Float2 ? 2 : 1;
+	}
+	layout.stride = stride;
+
+	// the box of the positions, each axis cut in 65535 steps
+	if (layout.positionFormat == PositionFormat::Unorm16)
+	{
+		Vector3f minP = count > 0 ? positions[0] : Vector3f(0.f, 0.f, 0.f);
+		Vector3f maxP = minP;
+		for (const auto& p : positions)
+		{
+			minP = Vector3f(std::min(minP.x, p.x), std::min(minP.y, p.y), std::min(minP.z, p.z));
+			maxP = Vector3f(std::max(maxP.x, p.x), std::max(maxP.y, p.y), std::max(maxP.z, p.z));
+		}
+		layout.positionBias = minP;
+		layout.positionScale = (1.f / 65535.f) * (maxP - minP);
+	}
+	auto quantize = [&](float p, float bias, float scale) {
+		return scale > 0.f ? static_cast<uint32_t>(std::clamp((p - bias) / scale + 0.5f, 0.f, 65535.f)) : 0u;
+	};
+	auto snorm = [](float v, float maxValue) {
+		return static_cast<int32_t>(std::round(std::clamp(v, -1.f, 1.f) * maxValue));
+	};
+
+	data.assign(static_cast<size_t>(count) * stride, 0.f);
+	for (int i = 0; i < count; ++i)
+	{
+		float* v = &data[static_cast<size_t>(i) * stride];
+		const auto& p = positions[i];
+		float* pos = v + layout.positionOffset;
+		if (layout.positionFormat == PositionFormat::Float3)
+		{
+			pos[0] = p.x;
+			pos[1] = p.y;
+			pos[2] = p.z;
+		}
+		else
+		{
+			const auto& bias = layout.positionBias;
+			const auto& scale = layout.positionScale;
+			setWord(pos, quantize(p.x, bias.x, scale.x) | (quantize(p.y, bias.y, scale.y) << 16));
+			setWord(pos + 1, quantize(p.z, bias.z, scale.z));
+		}
+
+		if (hasNormals)
+		{
+			float* nor = v + layout.normalOffset;
+			const auto& n = normals[i];
+			if (layout.normalFormat == NormalFormat::Float3)
+			{
+				nor[0] = n.x;
+				nor[1] = n.y;
+				nor[2] = n.z;
+			}
+			else
+			{
+				float x, y;
+				encodeOctahedral(n, x, y);
+				if (layout.normalFormat == NormalFormat::Oct16)
+					setWord(nor, getWord(nor) | ((snorm(x, 127.f) & 0xff) << 16) | ((snorm(y, 127.f) & 0xff) << 24));
+				else
+					setWord(nor, (snorm(x, 32767.f) & 0xffff) | ((snorm(y, 32767.f) & 0xffff) << 16));
+			}
+		}
+
+		if (hasUvs)
+		{
+			float* uv = v + layout.uvOffset;
+			if (layout.uvFormat == UvFormat::Float2)
+			{
+				uv[0] = uvs[i].x;
+				uv[1] = uvs[i].y;
+			}
+			else
+			{
+				setWord(uv, floatToHalf(uvs[i].x) | (static_cast<uint32_t>(floatToHalf(uvs[i].y)) << 16));
+			}
+		}
+	}
+
+#ifdef _DEBUG
+	checkInterleaved(positions, normals, uvs, layout, data);
+#endif
+}
+
+void VertexFormat::encodeOctahedral(const Vector3f& n, float& x, float& y)
+{
+	float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+	if (l1 <= 0.f)
+	{
+		x = y = 0.f;
+		return;
+	}
+	x = n.x / l1;
+	y = n.y / l1;
+	// the lower half is folded over the diagonals
+	if (n.z < 0.f)
+	{
+		float fx = (1.f - std::fabs(y)) * (x >= 0.f ? 1.f : -1.f);
+		float fy = (1.f - std::fabs(x)) * (y >= 0.f ? 1.f : -1.f);
+		x = fx;
+		y = fy;
+	}
+}
+
+uint16_t VertexFormat::floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = static_cast<int>((bits >> 23) & 0xff) - 112;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff)
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+	if (exponent >= 31)
+		return static_cast<uint16_t>(sign | 0x7c00);
+
+	uint32_t half;
+	uint32_t rest;
+	uint32_t midpoint;
+	if (exponent <= 0)
+	{
+		// subnormal, the implicit bit shifted in with the rest
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		half = mantissa >> shift;
+		rest = mantissa & ((1u << shift) - 1);
+		midpoint = 1u << (shift - 1);
+	}
+	else
+	{
+		half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+		rest = mantissa & 0x1fff;
+		midpoint = 0x1000;
+	}
+	// a carry out of the mantissa steps the exponent, up to infinity
+	if (rest > midpoint || (rest == midpoint && (half & 1)))
+		++half;
+	return static_cast<uint16_t>(sign | half);
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#ifndef M_VERTEX_FORMAT_H
+#define M_VERTEX_FORMAT_H
+
+#include "Math.h"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+enum class PositionFormat
+{
+	Float3,			// 3 words
+	Unorm16,		// 2 words, x | y << 16 then z in the low half, over the box positionBias + q * positionScale
+};
+
+enum class NormalFormat
+{
+	Float3,			// 3 words
+	Oct16,			// octahedral, 2 snorm8 in the high half of a word. shares the second word of an Unorm16 position
+	Oct32,			// octahedral, 2 snorm16 in a word
+};
+
+enum class UvFormat
+{
+	Float2,			// 2 words
+	Half2,			// u | v << 16 as half floats in a word
+};
+
+// 32-bit words per vertex and the offset of each attribute in it, -1 if the buffer has no such attribute.
+// words of the compact formats hold bit patterns, they are only read through VertexFormat
+struct VertexLayout
+{
+	int stride = 0;
+	int positionOffset = -1;
+	int normalOffset = -1;
+	int uvOffset = -1;
+
+	PositionFormat positionFormat = PositionFormat::Float3;
+	NormalFormat normalFormat = NormalFormat::Float3;
+	UvFormat uvFormat = UvFormat::Float2;
+	Vector3f positionBias{ 0.f, 0.f, 0.f };
+	Vector3f positionScale{ 1.f, 1.f, 1.f };
+};
+
+// encodes the attributes of an interleaved vertex buffer and decodes them in the vertex fetch
+class VertexFormat
+{
+public:
+	// positions, normals and uvs into data in the formats of layout, which gets its offsets, stride and
+	// position box. the attributes missing from the vectors get no offset
+	static void interleave(const std::vector<Vector3f>& positions,
+		const std::vector<Vector3f>& normals,
+		const std::vector<Vector2f>& uvs,
+		VertexLayout& layout,
+		std::vector<float>& data);
+
+	// v : the first word of the vertex
+	static Vector4f fetchPosition(const float* v, const VertexLayout& layout)
+	{
+		const float* p = v + layout.positionOffset;
+		if (layout.positionFormat == PositionFormat::Float3)
+			return Vector4f(p[0], p[1], p[2], 1.f);
+		uint32_t xy = getWord(p);
+		uint32_t z = getWord(p + 1) & 0xffff;
+		return Vector4f(layout.positionBias.x + (xy & 0xffff) * layout.positionScale.x,
+			layout.positionBias.y + (xy >> 16) * layout.positionScale.y,
+			layout.positionBias.z + z * layout.positionScale.z, 1.f);
+	};
+
+	static Vector3f fetchNormal(const float* v, const VertexLayout& layout)
+	{
+		const float* n = v + layout.normalOffset;
+		if (layout.normalFormat == NormalFormat::Float3)
+			return Vector3f(n[0], n[1], n[2]);
+		uint32_t word = getWord(n);
+		float x, y;
+		if (layout.normalFormat == NormalFormat::Oct16)
+		{
+			x = static_cast<int8_t>(word >> 16) * (1.f / 127.f);
+			y = static_cast<int8_t>(word >> 24) * (1.f / 127.f);
+		}
+		else
+		{
+			x = static_cast<int16_t>(word & 0xffff) * (1.f / 32767.f);
+			y = static_cast<int16_t>(word >> 16) * (1.f / 32767.f);
+		}
+		return decodeOctahedral(x, y);
+	};
+
+	static Vector2f fetchUv(const float* v, const VertexLayout& layout)
+	{
+		const float* t = v + layout.uvOffset;
+		if (layout.uvFormat == UvFormat::Float2)
+			return Vector2f{ t[0], t[1] };
+		uint32_t word = getWord(t);
+		return Vector2f{ halfToFloat(word & 0xffff), halfToFloat(word >> 16) };
+	};
+
+	// the square of the octahedron folded out from the unit sphere, [-1, 1]^2
+	static void encodeOctahedral(const Vector3f& n, float& x, float& y);
+	static Vector3f decodeOctahedral(float x, float y)
+	{
+		float z = 1.f - std::fabs(x) - std::fabs(y);
+		if (z < 0.f)
+		{
+			float fx = (1.f - std::fabs(y)) * (x >= 0.f ? 1.f : -1.f);
+			float fy = (1.f - std::fabs(x)) * (y >= 0.f ? 1.f : -1.f);
+			x = fx;
+			y = fy;
+		}
+		float invLen = 1.f / std::sqrt(x * x + y * y + z * z);
+		return Vector3f(x * invLen, y * invLen, z * invLen);
+	};
+
+	// rounded to nearest even, out of range to infinity
+	static uint16_t floatToHalf(float value);
+	static float halfToFloat(uint32_t half)
+	{
+		uint32_t sign = (half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1f;
+		uint32_t mantissa = half & 0x3ff;
+		if (exponent == 0)
+		{
+			float subnormal = mantissa * (1.f / 16777216.f);
+			return sign != 0 ? -subnormal : subnormal;
+		}
+		uint32_t bits = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	};
+
+	static uint32_t getWord(const float* word)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, word, sizeof(bits));
+		return bits;
+	};
+	static void setWord(float* word, uint32_t bits) { std::memcpy(word, &bits, sizeof(bits)); };
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include "VirtualTexture.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+
+static Uint32 packTexel(const Vector4f& col)
+{
+	auto channel = [](float v) { return static_cast<Uint32>(MathUtility::clamp(v, 0.f, 255.f) + 0.5f); };
+	return channel(col.x) | (channel(col.y) << 8) | (channel(col.z) << 16) | (channel(col.w) << 24);
+}
+
+static Vector4f unpackTexel(Uint32 texel)
+{
+	return Vector4f(static_cast<float>(texel & 0xff), static_cast<float>((texel >> 8) & 0xff),
+		static_cast<float>((texel >> 16) & 0xff), static_cast<float>(texel >> 24));
+}
+
+// the page of mip holding uv, and the texel (x, y) from the left-top of the mip
+int VirtualTexture::getPage(int mip, float u, float v, int& x, int& y) const
+{
+	const auto& m = mips[mip];
+	x = MathUtility::clamp(static_cast<int>(u * m.width), 0, m.width - 1);
+	y = MathUtility::clamp(static_cast<int>((1.f - v) * m.height), 0, m.height - 1);
+	return m.firstPage + (y / PAGE_SIZE) * m.pagesX + x / PAGE_SIZE;
+}
+
+Vector4f VirtualTexture::sample(float u, float v, float dudx, float dvdx, float dudy, float dvdy) const
+{
+	// texels of mip 0 per pixel along the longer side of the footprint, squared. each mip halves it
+	float w = static_cast<float>(mips[0].width);
+	float h = static_cast<float>(mips[0].height);
+	float footprint = std::max(dudx * dudx * w * w + dvdx * dvdx * h * h, dudy * dudy * w * w + dvdy * dvdy * h * h);
+	int last = getMipCount() - 1;
+	int mip = footprint > 1.f ? std::min(static_cast<int>(0.5f * std::log2(footprint)), last) : 0;
+
+	int x, y;
+	int page = getPage(mip, u, v, x, y);
+	if (mip < last)
+		requested[page].store(cache->frame, std::memory_order_relaxed);
+	while (mip < last && pageSlots[page] < 0)
+		page = getPage(++mip, u, v, x, y);
+
+	if (mip == last)
+		return unpackTexel(tail[y * mips[last].width + x]);
+	const int mask = PAGE_SIZE - 1;
+	return unpackTexel(cache->getSlotTexels(pageSlots[page])[(y & mask) * PAGE_SIZE + (x & mask)]);
+}
+
+VirtualTextureCache::VirtualTextureCache(size_t budgetBytes)
+{
+	size_t slotCount = std::max<size_t>(budgetBytes / (PAGE_TEXELS * sizeof(Uint32)), 1);
+	pool.resize(slotCount * PAGE_TEXELS);
+	slots.resize(slotCount);
+
+	staging.resize(static_cast<size_t>(MAX_QUEUED) * PAGE_TEXELS);
+	for (int i = 0; i < MAX_QUEUED; ++i)
+		freeStaging.push_back(i);
+	requests.reserve(MAX_QUEUED);
+	loaded.reserve(MAX_QUEUED);
+	arrived.reserve(MAX_QUEUED);
+
+	// a file of its own in the temp directory, removed with the cache
+	std::error_code error;
+	auto dir = std::filesystem::temp_directory_path(error);
+	path = (dir / ("softrenderer_pages_" + std::to_string(std::random_device()()) + ".bin")).string();
+	file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+		printf("Could not create the page file %s!\n", path.c_str());
+
+	loader = std::thread(&VirtualTextureCache::load, this);
+}
+
+VirtualTextureCache::~VirtualTextureCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		quit = true;
+	}
+	cv.notify_all();
+	loader.join();
+
+	file.close();
+	std::error_code error;
+	std::filesystem::remove(path, error);
+}
+
+std::shared_ptr<VirtualTexture> VirtualTextureCache::create(const Texture& image)
+{
+	const int size = VirtualTexture::PAGE_SIZE;
+	auto texture = std::make_shared<VirtualTexture>();
+	texture->cache = this;
+
+	int w = std::max(image.width, 1);
+	int h = std::max(image.height, 1);
+	std::vector<Uint32> texels(static_cast<size_t>(w) * h);
+	for (int j = 0; j < image.height; ++j)
+		for (int i = 0; i < image.width; ++i)
+			texels[static_cast<size_t>(j) * w + i] = packTexel(image.getColor(i, j));
+
+	std::lock_guard<std::mutex> lock(fileMutex);
+	texture->fileOffset = fileSize;
+	std::vector<Uint32> page(PAGE_TEXELS);
+
+	// every mip down to the first that fits in a page
+	while (true)
+	{
+		VirtualTexture::Mip mip{ w, h, 0, 0, texture->pageCount };
+		if (w <= size && h <= size)
+		{
+			texture->mips.push_back(mip);
+			texture->tail = std::move(texels);
+			break;
+		}
+
+		mip.pagesX = (w + size - 1) / size;
+		mip.pagesY = (h + size - 1) / size;
+		texture->mips.push_back(mip);
+		texture->pageCount += mip.pagesX * mip.pagesY;
+
+		// the edge texels repeat in the part of the last pages outside the mip
+		for (int py = 0; py < mip.pagesY; ++py)
+		{
+			for (int px = 0; px < mip.pagesX; ++px)
+			{
+				for (int y = 0; y < size; ++y)
+				{
+					int sy = std::min(py * size + y, h - 1);
+					for (int x = 0; x < size; ++x)
+						page[y * size + x] = texels[static_cast<size_t>(sy) * w + std::min(px * size + x, w - 1)];
+				}
+				file.seekp(fileSize);
+				file.write(reinterpret_cast<const char*>(page.data()), PAGE_TEXELS * sizeof(Uint32));
+				fileSize += PAGE_TEXELS * sizeof(Uint32);
+			}
+		}
+
+		// 2x2 averages, the last row and column repeat for an odd size
+		int nw = (w + 1) / 2;
+		int nh = (h + 1) / 2;
+		std::vector<Uint32> next(static_cast<size_t>(nw) * nh);
+		for (int y = 0; y < nh; ++y)
+		{
+			int y0 = 2 * y;
+			int y1 = std::min(y0 + 1, h - 1);
+			for (int x = 0; x < nw; ++x)
+			{
+				int x0 = 2 * x;
+				int x1 = std::min(x0 + 1, w - 1);
+				Uint32 quad[] = { texels[static_cast<size_t>(y0) * w + x0], texels[static_cast<size_t>(y0) * w + x1],
+					texels[static_cast<size_t>(y1) * w + x0], texels[static_cast<size_t>(y1) * w + x1] };
+				Uint32 avg = 0;
+				for (int c = 0; c < 32; c += 8)
+				{
+					Uint32 sum = 0;
+					for (auto t : quad)
+						sum += (t >> c) & 0xff;
+					avg |= ((sum + 2) / 4) << c;
+				}
+				next[static_cast<size_t>(y) * nw + x] = avg;
+			}
+		}
+		texels = std::move(next);
+		w = nw;
+		h = nh;
+	}
+	file.flush();
+	if (!file)
+		printf("Could not write the pages of a virtual texture!\n");
+
+	texture->pageSlots.assign(texture->pageCount, -1);
+	texture->requested = std::make_unique<std::atomic<uint32_t>[]>(texture->pageCount);
+	texture->queued.assign(texture->pageCount, 0);
+	textures.push_back(texture);
+	maxMipCount = std::max(maxMipCount, texture->getMipCount());
+	return texture;
+}
+
+void VirtualTextureCache::load()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true)
+	{
+		cv.wait(lock, [&] { return quit || nextRequest < requests.size(); });
+		if (quit)
+			return;
+		Load request = requests[nextRequest++];
+		lock.unlock();
+
+		// the staging buffer is the request's until update() takes it back
+		{
+			std::lock_guard<std::mutex> fileLock(fileMutex);
+			char* dst = reinterpret_cast<char*>(&staging[static_cast<size_t>(request.staging) * PAGE_TEXELS]);
+			file.seekg(request.texture->fileOffset + static_cast<std::streamoff>(request.page) * PAGE_TEXELS * sizeof(Uint32));
+			file.read(dst, PAGE_TEXELS * sizeof(Uint32));
+			if (!file)
+			{
+				printf("Could not read a page of a virtual texture!\n");
+				file.clear();
+				std::fill(dst, dst + PAGE_TEXELS * sizeof(Uint32), 0);
+			}
+		}
+
+		lock.lock();
+		loaded.push_back(request);
+	}
+}
+
+// into a free slot, or the one used least recently. not into one the frame that was just drawn sampled:
+// then the budget is taken by what is on screen, the page is dropped and will be asked for again
+bool VirtualTextureCache::install(const Load& load)
+{
+	auto* texture = load.texture;
+	texture->queued[load.page] = 0;
+
+	int victim = -1;
+	for (int s = 0; s < static_cast<int>(slots.size()); ++s)
+	{
+		if (slots[s].texture == nullptr)
+		{
+			victim = s;
+			break;
+		}
+		if (slots[s].lastUsed < frame && (victim == -1 || slots[s].lastUsed < slots[victim].lastUsed))
+			victim = s;
+	}
+	if (victim == -1)
+		return false;
+
+	auto& slot = slots[victim];
+	if (slot.texture != nullptr)
+		slot.texture->pageSlots[slot.page] = -1;
+	else
+		++residentPages;
+
+	const Uint32* src = &staging[static_cast<size_t>(load.staging) * PAGE_TEXELS];
+	std::copy(src, src + PAGE_TEXELS, &pool[static_cast<size_t>(victim) * PAGE_TEXELS]);
+	slot.texture = texture;
+	slot.page = load.page;
+	slot.lastUsed = texture->requested[load.page].load(std::memory_order_relaxed);
+	texture->pageSlots[load.page] = victim;
+	return true;
+}
+
+int VirtualTextureCache::update()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		arrived.swap(loaded);
+		requests.erase(requests.begin(), requests.begin() + nextRequest);
+		nextRequest = 0;
+	}
+
+	// how recently each page in memory was used, from the stamps of the samples
+	for (auto& slot : slots)
+	{
+		if (slot.texture != nullptr)
+			slot.lastUsed = slot.texture->requested[slot.page].load(std::memory_order_relaxed);
+	}
+
+	int installed = 0;
+	for (const auto& load : arrived)
+	{
+		installed += install(load);
+		freeStaging.push_back(load.staging);
+	}
+	arrived.clear();
+
+	// what the frame asked for that is neither in memory nor on its way, the coarse mips first:
+	// they are the fallback of the finer ones
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (int m = maxMipCount - 2; m >= 0 && !freeStaging.empty(); --m)
+		{
+			for (const auto& texture : textures)
+			{
+				if (m >= texture->getMipCount() - 1)
+					continue;
+				const auto& mip = texture->mips[m];
+				for (int page = mip.firstPage; page < mip.firstPage + mip.pagesX * mip.pagesY && !freeStaging.empty(); ++page)
+				{
+					if (texture->requested[page].load(std::memory_order_relaxed) != frame || texture->pageSlots[page] >= 0 || texture->queued[page])
+						continue;
+					texture->queued[page] = 1;
+					requests.push_back(Load{ texture.get(), page, freeStaging.back() });
+					freeStaging.pop_back();
+				}
+			}
+		}
+	}
+	cv.notify_one();
+	++frame;
+	return installed;
+}
+
+bool VirtualTextureCache::isStreaming() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return nextRequest < requests.size() || !loaded.empty();
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#ifndef M_VIRTUAL_TEXTURE_H
+#define M_VIRTUAL_TEXTURE_H
+
+#include "Texture.h"
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cstdint>
+
+class VirtualTextureCache;
+
+// a texture whose mips are cut into PAGE_SIZE x PAGE_SIZE pages kept on disk, the cache brings in the
+// pages the samples ask for. the smallest mip, a page at most, always stays in memory and sampling
+// falls back to the finest mip in memory under the one asked for
+class VirtualTexture
+{
+public:
+	static const int PAGE_SIZE = 128;
+
+	// [0, 255] like Texture::getColorFromUV, nearest in the mip of the uv footprint of the pixel
+	// given by the derivatives of uv across the screen. the page of that mip is asked for even when
+	// a coarser one is sampled instead
+	Vector4f sample(float u, float v, float dudx, float dvdx, float dudy, float dvdy) const;
+
+	int getWidth() const { return mips[0].width; };
+	int getHeight() const { return mips[0].height; };
+	int getMipCount() const { return static_cast<int>(mips.size()); };
+
+private:
+	friend class VirtualTextureCache;
+
+	struct Mip
+	{
+		int width;
+		int height;
+		int pagesX;
+		int pagesY;
+		int firstPage;			// among the pages of the texture
+	};
+
+	VirtualTextureCache* cache = nullptr;
+	std::vector<Mip> mips;
+	int pageCount = 0;				// of every mip but the last, which is not paged
+	std::streamoff fileOffset = 0;	// of the first page in the page file of the cache
+	std::vector<Uint32> tail;		// the last mip
+
+	// slot in the cache of each page, -1 when it is not in memory. only changes between frames
+	std::vector<int> pageSlots;
+	// frame in which each page was last asked for, from every thread that samples
+	std::unique_ptr<std::atomic<uint32_t>[]> requested;
+	std::vector<uint8_t> queued;	// for the loader, cache only
+
+	int getPage(int mip, float u, float v, int& x, int& y) const;
+};
+
+// memory for the pages of the virtual textures it creates, up to a budget, and a thread that reads
+// the missing ones from the page file. update() between frames hands the pages that arrived to their
+// textures, evicting the ones used least recently, and queues those the last frame asked for
+class VirtualTextureCache
+{
+public:
+	static const int MAX_QUEUED = 64;		// pages being read at once
+
+	// budgetBytes : for the streamed pages, the smallest mip of each texture is on top of it
+	explicit VirtualTextureCache(size_t budgetBytes);
+	~VirtualTextureCache();
+	VirtualTextureCache(const VirtualTextureCache&) = delete;
+	VirtualTextureCache& operator=(const VirtualTextureCache&) = delete;
+
+	// writes the mips of image to the page file, the image can be released afterwards.
+	// not while update() runs
+	std::shared_ptr<VirtualTexture> create(const Texture& image);
+	// between frames, nothing may sample the textures meanwhile. returns how many pages came into memory
+	int update();
+
+	int getSlotCount() const { return static_cast<int>(slots.size()); };
+	int getResidentPages() const { return residentPages; };
+	bool isStreaming() const;
+
+private:
+	friend class VirtualTexture;
+
+	static const int PAGE_TEXELS = VirtualTexture::PAGE_SIZE * VirtualTexture::PAGE_SIZE;
+
+	struct Slot
+	{
+		VirtualTexture* texture = nullptr;
+		int page = -1;
+		uint32_t lastUsed = 0;
+	};
+
+	struct Load
+	{
+		VirtualTexture* texture;
+		int page;
+		int staging;			// buffer the loader reads the page into
+	};
+
+	// render thread
+	std::vector<Uint32> pool;			// slot s at s * PAGE_TEXELS
+	std::vector<Slot> slots;
+	int residentPages = 0;
+	uint32_t frame = 1;					// samples stamp their pages with it
+	std::vector<std::shared_ptr<VirtualTexture>> textures;
+	int maxMipCount = 0;
+	std::vector<Load> arrived;
+	std::vector<int> freeStaging;
+
+	std::string path;
+	std::fstream file;
+	std::mutex fileMutex;
+	std::streamoff fileSize = 0;
+
+	// shared with the loader, under mtx. reserved for MAX_QUEUED so nothing allocates while streaming
+	std::vector<Uint32> staging;
+	std::vector<Load> requests;			// taken from nextRequest on
+	size_t nextRequest = 0;
+	std::vector<Load> loaded;
+	std::thread loader;
+	mutable std::mutex mtx;
+	std::condition_variable cv;
+	bool quit = false;
+
+	void load();
+	bool install(const Load& load);
+	const Uint32* getSlotTexels(int slot) const { return &pool[static_cast<size_t>(slot) * PAGE_TEXELS]; };
+};
+
+#endif
\ No newline at end of file
@@ -1,9 +1,14 @@
 #include "Window.h"
+#include "FrameArena.h"
+#include "TextureCache.h"
 #include <algorithm>
+#include <limits>
+#include <cassert>
 
 const float MY_PI = 3.1415926;
 
-Window::Window(const unsigned int w, const unsigned int h) : width(w), height(h), initTime(std::chrono::system_clock::now())
+Window::Window(const unsigned int w, const unsigned int h, const int framesInFlight, const float frameBudgetMs) 
+	: resolution(w, h, frameBudgetMs), workers(std::make_shared<WorkerPool>()), post(workers), width(w), height(h), framesInFlight(framesInFlight), initTime(std::chrono::system_clock::now())
 {
 	if (!hasInited)
 		init();
@@ -11,6 +16,8 @@ Window::Window(const unsigned int w, const unsigned int h) : width(w), height(h)
 
 Window::~Window()
 {
+	// while the renderer is still there, the buffers of the meshes go back to its store
+	model.unload(renderer);
 	uninit();
 }
 
@@ -39,6 +46,7 @@ void Window::init()
 
 	screenSurface = SDL_GetWindowSurface(window);
 	renderer = Renderer(screenSurface);
+	renderer.setWorkerPool(workers);
 	SDL_FillRect(screenSurface, NULL, SDL_MapRGB(screenSurface->format, 0x00, 0x00, 0x00));
 	SDL_UpdateWindowSurface(window);
 	SDL_ShowCursor(false);
@@ -54,127 +62,559 @@ DrawParams Window::initData()
 	// this->model.load("model/nanosuit/nanosuit.obj");
 	// this->model.load("model/spot_triangulated_good.obj");
 	// this->model.load("model/jotaro.obj");
-	this->model.load("model/Bboy Hip Hop Move.fbx");
+	// the frames start before the model is in, its meshes show up as they are converted
+	this->model.loadAsync("model/Bboy Hip Hop Move.fbx");
 
-	renderer.setVertexShader(vectexShader);
+	renderer.setVertexShader(vectexShader, DefaultVaryings::COUNT);
 	renderer.setFragmentShader(fragmentShader);
 
 	dp.vsParams = vsParam;
 
 	FragmentShaderParams fsParam;
-	fsParam.textureVec = this->model.textureVec;
-
 	dp.fsParams = fsParam;
 
-	for (int i = 0; i < this->model.meshes.size(); ++i)
-	{
-		this->model.meshes[i].addToRenderer(&renderer);
-		this->model.meshes[i].setDrawParams(dp);
-	}
+	modelNode = scene.addNode();
 
 	dp.fsParams.lights.push_back(Light(Vector3f{ 20.f, 20.f, 100.f }, Vector3f{ 800.f, 800.f, 800.f }));
 	dp.fsParams.lights.push_back(Light(Vector3f{ -20.f, 20.f, 0.f }, Vector3f{ 800.f, 800.f, 800.f }));
 	dp.fsParams.lights.push_back(Light(Vector3f{ -20.f, -20.f, 0.f }, Vector3f{ 800.f, 800.f, 800.f }));
 
+	shadowMap = std::make_shared<ShadowMap>(renderer, 512, 45.f, 1.f, 200.f);
+	dp.fsParams.shadowMaps.push_back(shadowMap);
+	dp.fsParams.lights[0].shadowMapIdx = 0;
+
+	occlusionCuller = std::make_shared<OcclusionCuller>(renderer);
+
 	return dp;
 }
 
+void Window::setCompactVertices(bool compact)
+{
+	VertexLayout format;
+	if (compact)
+	{
+		format.positionFormat = PositionFormat::Unorm16;
+		format.normalFormat = NormalFormat::Oct16;
+		format.uvFormat = UvFormat::Half2;
+	}
+	this->model.vertexFormat = format;
+}
+
+// render thread, between frames: the meshes and textures of the model that finished loading.
+// true if anything came in
+bool Window::updateModel(DrawParams& dp)
+{
+	int firstMesh = static_cast<int>(this->model.meshes.size());
+	if (this->model.update(renderer) == 0)
+		return false;
+
+	int meshCount = static_cast<int>(this->model.meshes.size());
+	for (int i = firstMesh; i < meshCount; ++i)
+	{
+		auto& mesh = this->model.meshes[i];
+		mesh.setDrawParams(dp);
+
+		int node = scene.addNode(modelNode);
+		scene.setBounds(node, mesh.boundCenter, mesh.boundRadius);
+		scene.setUserData(node, i);
+		meshNodes.push_back(node);
+	}
+
+	// the biggest meshes are the occluders
+	float maxRadius = 0.f;
+	for (const auto& mesh : this->model.meshes)
+		maxRadius = std::max(maxRadius, mesh.boundRadius);
+	for (int node : meshNodes)
+		scene.setOccluder(node, this->model.meshes[scene.getUserData(node)].boundRadius >= 0.5f * maxRadius);
+
+	dp.fsParams.textureVec = this->model.textureVec;
+	if (textureCache)
+		streamTextures(dp);
+	return true;
+}
+
+// the textures become virtual ones paged in within the budget, only their smallest mips stay whole
+void Window::streamTextures(DrawParams& dp)
+{
+	if (!textureCache)
+		textureCache = std::make_shared<VirtualTextureCache>(static_cast<size_t>(textureBudgetMb) << 20);
+	auto& textures = dp.fsParams.textureVec;
+	dp.fsParams.virtualTextureVec.resize(textures.size());
+	for (int i = 0; i < static_cast<int>(textures.size()); ++i)
+	{
+		if (!textures[i] || dp.fsParams.virtualTextureVec[i])
+			continue;
+		dp.fsParams.virtualTextureVec[i] = textureCache->create(*textures[i]);
+		textures[i] = nullptr;
+		this->model.textureVec[i] = nullptr;
+	}
+	// the whole images would otherwise stay in the texture cache for a reload
+	TextureCache::global().trim(0);
+}
+
 void Window::loop()
 {
 	if (!hasInited)
 		init();
 
 	DrawParams dp = initData();
+	if (textureBudgetMb > 0)
+		streamTextures(dp);
 
 	SDL_Event e;
 	bool quit = false;
 
 	float allangle = 0.f;
 
+	// render on a worker, present here: SDL wants the window and its events on the main thread
+	FramePipeline pipeline(screenSurface, framesInFlight);
+	pipeline.start([&](FramePipeline::Target& target) {
+		renderFrame(target, dp, allangle);
+	});
+
 	while (quit == false)
 	{
-		float yawDiff = 0.f;
-		float pitchDiff = 0.f;
+		{
+			std::lock_guard<std::mutex> lock(inputMutex);
+			while (SDL_PollEvent(&e))
+				handleEvent(e, quit);
+		}
+
+		pipeline.present(window, screenSurface);
+	}
+
+	pipeline.stop();
+}
+
+// main thread, inputMutex is held
+void Window::handleEvent(const SDL_Event& e, bool& quit)
+{
+	auto& camera = input.camera;
+	switch (e.type)
+	{
+		case SDL_QUIT:
+			quit = true;
+			break;
+		case SDL_MOUSEMOTION:
+			// std::cout << "xrel : " << e.motion.xrel << "yrel : " << e.motion.yrel << std::endl;
+			camera.addYaw(-e.motion.xrel / 20.f);
+			camera.addPitch(-e.motion.yrel / 20.f);
+			break;
+		case SDL_KEYDOWN:
+			if (e.key.keysym.sym == SDLK_w)
+				camera.MoveFwd(1);
+			else if (e.key.keysym.sym == SDLK_s)
+				camera.MoveFwd(-1);
+			else if (e.key.keysym.sym == SDLK_d)
+				camera.MoveRight(1);
+			else if (e.key.keysym.sym == SDLK_a)
+				camera.MoveRight(-1);
+			else if (e.key.keysym.sym == SDLK_q)
+				camera.MoveUp(1);
+			else if (e.key.keysym.sym == SDLK_e)
+				camera.MoveUp(-1);
+			else if (e.key.keysym.sym == SDLK_SPACE)
+				input.type = static_cast<Primitive>((static_cast<int>(input.type) + 1)% static_cast<int>(Primitive::MAX_SIZE));
+			else if (e.key.keysym.sym == SDLK_z)
+				input.zPrepass = !input.zPrepass;
+			else if (e.key.keysym.sym == SDLK_v)
+				input.variableRateShading = !input.variableRateShading;
+			else if (e.key.keysym.sym == SDLK_r)
+				input.dynamicResolution = !input.dynamicResolution;
+			else if (e.key.keysym.sym == SDLK_m)
+				input.msaaSamples = input.msaaSamples == 1 ? 4 : (input.msaaSamples == 4 ? 8 : 1);
+			else if (e.key.keysym.sym == SDLK_o)
+				input.occlusionCulling = !input.occlusionCulling;
+			else if (e.key.keysym.sym == SDLK_i)
+				input.dirtyRects = !input.dirtyRects;
+			else if (e.key.keysym.sym == SDLK_h)
+				input.hdr = !input.hdr;
+			else if (e.key.keysym.sym == SDLK_c)
+				input.pointCloud = !input.pointCloud;
+			break;
+	}
+}
+
+// render thread
+void Window::renderClip(const std::string& dir, int frameCount, float fps)
+{
+	if (!hasInited)
+		return;
+	// the time of a frame is frame / fps, nan or inf otherwise
+	if (!(fps > 0.f))
+	{
+		printf("The frame rate of a clip must be positive, got %f\n", fps);
+		return;
+	}
+
+	DrawParams dp = initData();
+	this->model.wait();
+	updateModel(dp);
+
+	Camera camera;
+	Matrix4f view = camera.getViewMatrix();
+	dp.vsParams.p = MathUtility::getPerspctiveMatrix(45, width * 1.0f / (height * 1.0f), 0.1, 50.f);
+	dp.vsParams.zNear = 0.1f;
+	dp.vsParams.zFar = 50.f;
+
+	// the model as in the interactive view, without the spin
+	Matrix4f scale;
+	scale = { 0.1, 0, 0, 0,
+			0, 0.1, 0, 0,
+			0, 0, 0.1, 0,
+			0, 0, 0, 1 };
+	auto mv = view * scale;
+	auto mv_i_T = mv.inverse().transpose();
+	auto target = static_cast<Vector3f>(mv * Vector4f{ 0, 0, 0, 1 });
+
+	BatchRenderer batch(renderer, screenSurface);
+	// a shadow map renders through its own renderer, one per worker
+	std::vector<std::shared_ptr<ShadowMap>> shadowMaps(batch.getWorkerCount());
+	// posed once per frame for the shadow pass and the color pass, kept so the next frame reuses the vectors
+	std::vector<std::vector<DrawParams>> workerDraws(batch.getWorkerCount());
+
+	batch.run(frameCount, [&](Renderer& r, int frame, int worker) {
+		auto& shadowMap = shadowMaps[worker];
+		if (!shadowMap)
+			shadowMap = std::make_shared<ShadowMap>(r, 512, 45.f, 1.f, 200.f);
+
+		auto& draws = workerDraws[worker];
+		draws.resize(model.meshes.size());
+		for (int i = 0; i < static_cast<int>(draws.size()); ++i)
+		{
+			auto& params = draws[i];
+			params = dp;
+			model.meshes[i].setDrawParams(params, frame / fps);
+			params.vsParams.mv = mv;
+			params.vsParams.mv_i_T = mv_i_T;
+			params.fsParams.shadowMaps = { shadowMap };
+		}
+
+		shadowMap->begin(dp.fsParams.lights[0], target);
+		for (auto& params : draws)
+			shadowMap->draw(params);
+
+		r.clearColor(Vector4f{ 0.0f, 0.0f, 0.0f, 0.0f });
+		r.clearZ();
+		for (auto& params : draws)
+			r.draw(params);
+		r.resolve();
+	}, [&](int frame, Texture& image) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s/frame_%04d.bmp", dir.c_str(), frame);
+		if (SDL_SaveBMP(image.getRawSurface(), path) != 0)
+			printf("Could not write %s! SDL_Error: %s\n", path, SDL_GetError());
+	});
+}
+
+void Window::renderFrame(FramePipeline::Target& target, DrawParams& dp, float& allangle)
+{
+	auto frameStart = std::chrono::steady_clock::now();
+	auto heapAllocations = FrameArena::getHeapAllocations();
+
+	FrameInput frame;
+	{
+		std::lock_guard<std::mutex> lock(inputMutex);
+		frame = input;
+	}
+	dp.type = frame.type;
+
+	// what finished loading since the last frame, and the pages it asked for that arrived.
+	// the frames before it are done drawing
+	texturesChanged = updateModel(dp);
+	if (textureCache && textureCache->update() > 0)
+		texturesChanged = true;
+
+	// ------------------------------------
+	Matrix4f rotation;
+	allangle += 3.0f;
+	auto angle = allangle * MY_PI / 180.f;
+	rotation = { cos(angle), 0, sin(angle), 0,
+					0, 1, 0, 0,
+					-sin(angle), 0, cos(angle), 0,
+					0, 0, 0, 1 };
+
+	Matrix4f scale;
+	scale = { 0.1, 0, 0, 0,
+			0, 0.1, 0, 0,
+			0, 0, 0.1, 0,
+			0, 0, 0, 1 };
+
+	Matrix4f translate;
+	translate = { 1, 0, 0, 0,
+					0, 1, 0, 0,
+					0, 0, 1, 0,
+					0, 0, 0, 1 };
+
+	// only the subtree of a changed node gets its world transforms recomputed
+	scene.setLocalTransform(modelNode, translate * rotation * scale);
+	scene.update();
+
+	Matrix4f view = frame.camera.getViewMatrix();
+	// the aspect ratio is the window's, a lower resolution only stretches the pixels
+	Matrix4f projection = MathUtility::getPerspctiveMatrix(45, width *1.0f / (height*1.0f) , 0.1, 50.f);
+
+	dp.vsParams.p = projection;
+	dp.vsParams.zNear = 0.1f;
+	dp.vsParams.zFar = 50.f;
+	// ----------------------------------------
+	
+	renderer.setRenderTarget(target.texture);
+	if (frame.dynamicResolution)
+		renderer.setResolution(resolution.getWidth(), resolution.getHeight());
+	else
+		renderer.setResolution(width, height);
+	renderer.setVariableRateShading(frame.variableRateShading);
+	if (renderer.isHdr() != frame.hdr)
+		renderer.setHdr(frame.hdr);
+	target.width = renderer.getWidth();
+	target.height = renderer.getHeight();
+	if (renderer.getSampleCount() != frame.msaaSamples)
+		renderer.setSampleCount(frame.msaaSamples);
+
+	auto diff = std::chrono::system_clock::now() - initTime;
+	float animSec = std::chrono::duration_cast<std::chrono::microseconds>(diff).count() * 1.0 / 1000000;
+	drawModel(dp, view, animSec, frame, target.index);
+	renderer.resolve();
+	// bloom and fxaa reach past what changed, the whole target is written from the float one
+	renderer.disableScissor();
+	if (frame.hdr)
+		post.run(renderer.getHdrTarget(), target.texture);
+	if (frame.variableRateShading)
+		renderer.updateShadingRates();
+
+	auto frameTime = std::chrono::steady_clock::now() - frameStart;
+	resolution.update(std::chrono::duration_cast<std::chrono::microseconds>(frameTime).count() / 1000.f);
+
+	// once the same draws at the same settings went into every target, the buffers have grown
+	// as much as they need and whatever else is transient came from the frame arena
+	int settings[] = { renderer.getWidth(), renderer.getHeight(), renderer.getSampleCount(), static_cast<int>(frame.type),
+		frame.zPrepass, frame.variableRateShading, frame.occlusionCulling, frame.dirtyRects, frame.hdr, frame.pointCloud };
+	auto signature = DirtyRegion::hash(settings, sizeof(settings), drawsSignature);
+	steadyFrames = signature == steadySignature ? steadyFrames + 1 : 0;
+	steadySignature = signature;
+	assert(steadyFrames <= framesInFlight || FrameArena::getHeapAllocations() == heapAllocations);
+	(void)heapAllocations;
+
+	FrameArena::local().reset();
+}
+
+// once per frame, the camera pass, the shadow pass and the occluders all draw this pose.
+// an animation moves the mesh out of its bind-pose bounds, the nodes get the bounds of the pose
+void Window::poseMeshes(float animSec)
+{
+	meshPoses.resize(this->model.meshes.size());
+	for (int i = 0; i < static_cast<int>(meshPoses.size()); ++i)
+	{
+		const auto& mesh = this->model.meshes[i];
+		auto& pose = meshPoses[i];
+		mesh.getBoneTransform(animSec, pose.bones);
+		mesh.getPosedBounds(pose.bones, pose.boundCenter, pose.boundRadius);
+		if (mesh.anim != nullptr)
+			scene.setBounds(meshNodes[i], pose.boundCenter, pose.boundRadius);
+	}
+	scene.update();
+}
 
-		while (SDL_PollEvent(&e))
+// the meshes whose bounds intersect the frustum of cullMatrix (clip from world), matrices from the cached world transforms
+void Window::recordVisible(CommandBuffer& cmds, DrawParams& dp, const Matrix4f& view, const Matrix4f& cullMatrix, bool occlusionCulling, bool shadowCasters)
+{
+	visibleNodes.clear();
+	scene.queryFrustum(cullMatrix, visibleNodes);
+
+	// (view * world)^-T = view^-T * world^-T, the second one is cached by the scene
+	auto viewInverseT = view.inverse().transpose();
+	auto setDrawParams = [&](int node) {
+		int mesh = scene.getUserData(node);
+		const auto& pose = meshPoses[mesh];
+		this->model.meshes[mesh].setDrawParams(dp, pose.bones);
+		// the renderer skips the draws whose sphere misses the dirty rect, the posed one
+		dp.boundCenter = pose.boundCenter;
+		dp.boundRadius = pose.boundRadius;
+		dp.vsParams.mv = view * scene.getWorldTransform(node);
+		dp.vsParams.mv_i_T = viewInverseT * scene.getNormalTransform(node);
+	};
+
+	// the occluders go into the low resolution depth first, the rest is tested against it
+	if (occlusionCulling)
+	{
+		occlusionCuller->begin();
+		for (int node : visibleNodes)
 		{
-			switch (e.type)
-			{
-				case SDL_QUIT:
-					quit = true;
-					break;
-				case SDL_MOUSEMOTION:
-					// std::cout << "xrel : " << e.motion.xrel << "yrel : " << e.motion.yrel << std::endl;
-					yawDiff = -e.motion.xrel / 20.f;
-					pitchDiff = -e.motion.yrel / 20.f;
-					break;
-				case SDL_KEYDOWN:
-					if (e.key.keysym.sym == SDLK_w)
-						camera.MoveFwd(1);
-					else if (e.key.keysym.sym == SDLK_s)
-						camera.MoveFwd(-1);
-					else if (e.key.keysym.sym == SDLK_d)
-						camera.MoveRight(1);
-					else if (e.key.keysym.sym == SDLK_a)
-						camera.MoveRight(-1);
-					else if (e.key.keysym.sym == SDLK_q)
-						camera.MoveUp(1);
-					else if (e.key.keysym.sym == SDLK_e)
-						camera.MoveUp(-1);
-					else if (e.key.keysym.sym == SDLK_SPACE)
-						dp.type = static_cast<Primitive>((static_cast<int>(dp.type) + 1)% static_cast<int>(Primitive::MAX_SIZE));
-					break;
-			}
+			if (!scene.isOccluder(node))
+				continue;
+			setDrawParams(node);
+			occlusionCuller->drawOccluder(dp);
 		}
+	}
 
-		// ------------------------------------
-		Matrix4f rotation;
-		allangle += 3.0f;
-		auto angle = allangle * MY_PI / 180.f;
-		rotation = { cos(angle), 0, sin(angle), 0,
-						0, 1, 0, 0,
-						-sin(angle), 0, cos(angle), 0,
-						0, 0, 0, 1 };
-
-		Matrix4f scale;
-		scale = { 0.1, 0, 0, 0,
-				0, 0.1, 0, 0,
-				0, 0, 0.1, 0,
-				0, 0, 0, 1 };
-
-		Matrix4f translate;
-		translate = { 1, 0, 0, 0,
-						0, 1, 0, 0,
-						0, 0, 1, 0,
-						0, 0, 0, 1 };
-
-		Matrix4f model = translate * rotation * scale;
-		camera.addYaw(yawDiff);
-		camera.addPitch(pitchDiff);
-		Matrix4f view = camera.getViewMatrix();
-		Matrix4f projection = MathUtility::getPerspctiveMatrix(45, width *1.0f / (height*1.0f) , 0.1, 50.f);
-
-		dp.vsParams.p = projection;
-		dp.vsParams.mv = view * model;
-		dp.vsParams.mv_i_T = (view * model).inverse().transpose();
-		dp.vsParams.zNear = 0.1f;
-		dp.vsParams.zFar = 50.f;
-		// ----------------------------------------
-		
-		renderer.clearColor(Vector4f{ 0.0f, 0.0f, 0.0f,0.0f });
-		renderer.clearZ();
-
-		auto diff = std::chrono::system_clock::now() - initTime;
-		float animSec = std::chrono::duration_cast<std::chrono::microseconds>(diff).count() * 1.0 / 1000000;
-		for (int i = 0; i < this->model.meshes.size(); ++i)
+	cmds.clear();
+	for (int node : visibleNodes)
+	{
+		setDrawParams(node);
+		if (occlusionCulling && !scene.isOccluder(node) && !occlusionCuller->isVisible(scene.getBounds(node), dp.vsParams))
+			continue;
+
+		// anything the pixels of the draw depend on: transform, pose, geometry and material
+		const auto& fsp = dp.fsParams;
+		auto signature = DirtyRegion::hash(dp.vsParams.mv.num, sizeof(dp.vsParams.mv.num));
+		signature = DirtyRegion::hash(dp.boneTransform.data(), dp.boneTransform.size() * sizeof(Matrix4f), signature);
+		signature = DirtyRegion::hash(&dp.vtxId, sizeof(dp.vtxId), signature);
+		signature = DirtyRegion::hash(&dp.indId, sizeof(dp.indId), signature);
+		const auto& material = *fsp.material;
+		signature = DirtyRegion::hash(&material.features, sizeof(material.features), signature);
+		signature = DirtyRegion::hash(&material.ambient, sizeof(material.ambient), signature);
+		signature = DirtyRegion::hash(&material.Kd, sizeof(material.Kd), signature);
+		signature = DirtyRegion::hash(&material.Ks, sizeof(material.Ks), signature);
+		signature = DirtyRegion::hash(&material.Ns, sizeof(material.Ns), signature);
+		signature = DirtyRegion::hash(&material.diffuseTextureIdx, sizeof(material.diffuseTextureIdx), signature);
+		signature = DirtyRegion::hash(&material.specularTextureIdx, sizeof(material.specularTextureIdx), signature);
+		signature = DirtyRegion::hash(&dp.shadingRate, sizeof(dp.shadingRate), signature);
+		// a caster changes the pixels its shadow falls on, keyed apart from its own draw
+		dirtyRegion.addDraw(shadowCasters ? -1 - node : node, getDirtyRect(node, dp, view, shadowCasters), signature);
+		drawsSignature = DirtyRegion::hash(&node, sizeof(node), drawsSignature);
+
+		cmds.draw(dp);
+	}
+	cmds.sort();
+}
+
+// the bounds of the node are those of the pose drawn this frame, see poseMeshes
+ScreenRect Window::getDirtyRect(int node, const DrawParams& dp, const Matrix4f& view, bool shadowCaster)
+{
+	auto corner = [](const Aabb& box, int k) {
+		return Vector4f{ k & 1 ? box.max.x : box.min.x, k & 2 ? box.max.y : box.min.y, k & 4 ? box.max.z : box.min.z, 1.f };
+	};
+
+	ScreenRect screen;
+	screen.x1 = renderer.getWidth() - 1;
+	screen.y1 = renderer.getHeight() - 1;
+
+	Vector4f points[16];
+	for (int k = 0; k < 8; ++k)
+		points[k] = dp.vsParams.mv * corner(scene.getBounds(node), k);
+	int count = 8;
+
+	// the shadow lies in the cone from the light through the box, up to the farthest corner of the scene
+	if (shadowCaster)
+	{
+		auto light = dp.fsParams.lights[0].position;
+		float sceneDist = 0.f;
+		for (int k = 0; k < 8; ++k)
+			sceneDist = std::max(sceneDist, (static_cast<Vector3f>(view * corner(scene.getBvh().getRootBox(), k)) - light).length());
+
+		float casterDist = std::numeric_limits<float>::max();
+		Aabb casterBox{ static_cast<Vector3f>(points[0]), static_cast<Vector3f>(points[0]) };
+		for (int k = 0; k < 8; ++k)
 		{
-			this->model.meshes[i].setDrawParams(dp, animSec);
-			renderer.draw(dp);
+			auto p = static_cast<Vector3f>(points[k]);
+			casterDist = std::min(casterDist, (p - light).length());
+			casterBox = Aabb::merge(casterBox, Aabb{ p, p });
 		}
-		SDL_BlitSurface(renderer.getRenderTexture().getRawSurface(), NULL, screenSurface, NULL);
+		// a light inside the caster shadows everything
+		if (casterBox.contains(Aabb{ light, light }) || casterDist <= 0.f)
+			return screen;
 
-		SDL_UpdateWindowSurface(window);
+		float t = std::max(1.f, sceneDist / casterDist);
+		for (int k = 0; k < 8; ++k)
+		{
+			auto p = light + t * (static_cast<Vector3f>(points[k]) - light);
+			points[8 + k] = Vector4f{ p.x, p.y, p.z, 1.f };
+		}
+		count = 16;
 	}
+
+	return DirtyRegion::getScreenRect(points, count, dp.vsParams.p, dp.vsParams.zNear, renderer.getWidth(), renderer.getHeight());
+}
+
+void Window::drawModel(DrawParams& dp, const Matrix4f& view, float animSec, const FrameInput& frame, int targetIndex)
+{
+	// the model sits at the origin of its node
+	auto target = static_cast<Vector3f>(view * scene.getWorldTransform(modelNode) * Vector4f{ 0, 0, 0, 1 });
+	shadowMap->begin(dp.fsParams.lights[0], target);
+
+	// what every pixel depends on: the camera, the light's projection and the render settings.
+	// the shading rates follow the luminance of the whole last frame
+	auto lightViewProj = shadowMap->getViewProjection();
+	int settings[] = { renderer.getWidth(), renderer.getHeight(), renderer.getSampleCount(), static_cast<int>(frame.type), frame.zPrepass, frame.hdr,
+		frame.pointCloud };
+	auto signature = DirtyRegion::hash(view.num, sizeof(view.num));
+	signature = DirtyRegion::hash(dp.vsParams.p.num, sizeof(dp.vsParams.p.num), signature);
+	signature = DirtyRegion::hash(lightViewProj.num, sizeof(lightViewProj.num), signature);
+	signature = DirtyRegion::hash(settings, sizeof(settings), signature);
+	dirtyRegion.beginFrame(!frame.dirtyRects || frame.variableRateShading || texturesChanged || signature != frameSignature);
+	frameSignature = signature;
+	drawsSignature = DirtyRegion::hash(nullptr, 0);		// the hash of nothing, recordVisible adds the nodes
+
+	// casters outside the camera frustum still shadow what is inside, cull them against the light's
+	// only the camera's draws are culled by occlusion, what is hidden from it may still cast shadows
+	poseMeshes(animSec);
+	recordVisible(commands, dp, view, dp.vsParams.p * view, frame.occlusionCulling, false);
+	recordVisible(shadowCommands, dp, view, lightViewProj * view, false, true);
+
+	// the rest of the target still holds what it showed when it was last drawn into.
+	// with hdr there is one float target for every frame, it only misses what changed since the last one
+	auto region = dirtyRegion.endFrame(frame.hdr ? 0 : targetIndex, renderer.getWidth(), renderer.getHeight());
+	renderer.setScissor(region);
+	if (region.empty())
+		return;
+	renderer.clearColor(Vector4f{ 0.0f, 0.0f, 0.0f,0.0f });
+	renderer.clearZ();
+
+	// shadow map and depth pre-pass, depth only
+	if (frame.zPrepass)
+		renderer.setRenderPass(RenderPass::DepthOnly);
+	shadowCommands.execute([&](DrawParams& param) {
+		shadowMap->draw(param);
+	});
+	if (frame.zPrepass)
+		commands.execute(renderer);
+
+	renderer.setRenderPass(frame.zPrepass ? RenderPass::ColorEqualDepth : RenderPass::Color);
+	commands.execute(renderer);
+	renderer.setRenderPass(RenderPass::Color);
+
+	// the scan doesn't move, the points inside the dirty rect are drawn again
+	if (frame.pointCloud)
+		drawScan(view, dp);
+}
+
+// a scan of the ground around the model, half a million rippled points in rings. only the chunks
+// in the frustum are drawn, so turning the camera away from most of it makes it cheaper
+void Window::drawScan(const Matrix4f& view, const DrawParams& dp)
+{
+	if (scan.getPointCount() == 0)
+	{
+		const int count = 1 << 19;
+		std::vector<Vector3f> positions(count);
+		std::vector<Vector4f> colors(count);
+		// under the feet of the model, at its origin while it is loading
+		float ground = meshNodes.empty() ? 0.f : scene.getBvh().getRootBox().min.y;
+		unsigned int seed = 1;
+		auto random = [&seed]() {
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) / 16777216.f;
+		};
+		for (int i = 0; i < count; ++i)
+		{
+			float angle = random() * 2.f * MY_PI;
+			float r = 2.f + 6.f * std::sqrt(random());
+			float height = 0.1f * std::sin(3.f * r) * std::cos(5.f * angle);
+			positions[i] = Vector3f(r * std::cos(angle), ground + height, r * std::sin(angle));
+			float t = 0.5f + 5.f * height;
+			colors[i] = Vector4f{ 0.3f + 0.4f * t, 0.5f + 0.3f * t, 0.3f, 1.f };
+		}
+		scan.build(renderer, positions, colors);
+	}
+
+	DrawParams params;
+	params.type = Primitive::Point;
+	params.pointSize = 2;
+	params.vsParams.mv = view;
+	params.vsParams.p = dp.vsParams.p;
+	params.vsParams.zNear = dp.vsParams.zNear;
+	params.vsParams.zFar = dp.vsParams.zFar;
+	renderer.drawPointCloud(scan, params);
 }
 
 void Window::uninit()
@@ -10,29 +10,116 @@
 #include "fragmentShader.h"
 #include "Model.h"
 #include "Camera.h"
+#include "ShadowMap.h"
+#include "FramePipeline.h"
+#include "DynamicResolution.h"
+#include "CommandBuffer.h"
+#include "Scene.h"
+#include "OcclusionCuller.h"
+#include "DirtyRegion.h"
+#include "BatchRenderer.h"
+#include "PostChain.h"
+#include "VirtualTexture.h"
+#include "PointCloud.h"
 #include <chrono>
+#include <mutex>
+#include <string>
+
+// what the main thread hands over to the render thread for each frame
+struct FrameInput
+{
+	Camera camera;
+	Primitive type = Primitive::Triangle;
+	bool zPrepass = false;						// toggled by z
+	int msaaSamples = 1;						// 1, 4 or 8, cycled by m
+	bool dynamicResolution = true;				// toggled by r
+	bool variableRateShading = false;			// toggled by v
+	bool occlusionCulling = true;				// toggled by o
+	bool dirtyRects = true;						// toggled by i, redraw only what changed on screen
+	bool hdr = false;							// toggled by h, bloom, tone mapping and fxaa on a float target
+	bool pointCloud = false;					// toggled by c, a scanned ground around the model drawn as points
+};
 
 class Window
 {
 public:
-	Window(const unsigned int w = 800, const unsigned int h = 600);
+	// framesInFlight : see FramePipeline, 1 for the lowest latency
+	// frameBudgetMs : the render resolution drops down to half to stay within it
+	Window(const unsigned int w = 800, const unsigned int h = 600, const int framesInFlight = 2, const float frameBudgetMs = 33.3f);
+	// megabytes : the interactive view streams the pages of the textures within it, 0 keeps them whole.
+	// before loop()
+	void setTextureBudget(int megabytes) { textureBudgetMb = megabytes; };
+	// 16-bit positions in the box of the mesh, 8-bit octahedral normals and half float uvs, 12 bytes a vertex
+	// instead of 32. before loop()
+	void setCompactVertices(bool compact);
+	// of the depth buffer, D32F by default. D24 and D16 take the same or half the memory at a lower precision
+	void setDepthFormat(DepthFormat format) { renderer.setDepthFormat(format); };
 	void loop();
+	// offline: render frameCount frames of the animation at fps on every core, written in order as dir/frame_0000.bmp...
+	void renderClip(const std::string& dir, int frameCount, float fps = 30.f);
 	virtual ~Window();
 private:
 	void init();
 	DrawParams initData();
+	bool updateModel(DrawParams& dp);
+	void streamTextures(DrawParams& dp);
 	void uninit();
+	void handleEvent(const SDL_Event& e, bool& quit);
+	void renderFrame(FramePipeline::Target& target, DrawParams& dp, float& allangle);
+	void drawModel(DrawParams& dp, const Matrix4f& view, float animSec, const FrameInput& frame, int targetIndex);
+	void poseMeshes(float animSec);
+	void drawScan(const Matrix4f& view, const DrawParams& dp);
+	void recordVisible(CommandBuffer& cmds, DrawParams& dp, const Matrix4f& view, const Matrix4f& cullMatrix, bool occlusionCulling, bool shadowCasters);
+	ScreenRect getDirtyRect(int node, const DrawParams& dp, const Matrix4f& view, bool shadowCaster);
 private:
 	SDL_Window* window = NULL;
 	SDL_Surface* screenSurface = NULL;
 	Renderer renderer;
 	Model model;
 
-	Camera camera;
+	std::shared_ptr<ShadowMap> shadowMap;		// for the first light
+	std::shared_ptr<OcclusionCuller> occlusionCuller;
+	DynamicResolution resolution;				// render thread only
+	CommandBuffer commands;						// render thread only
+	CommandBuffer shadowCommands;				// render thread only
+	std::shared_ptr<WorkerPool> workers;		// render thread only, for the point draws and the post chain
+	PostChain post;								// render thread only
+	std::shared_ptr<VirtualTextureCache> textureCache;
+	PointCloud scan;							// render thread only, built the first time it is shown
+	int textureBudgetMb = 0;
+	bool texturesChanged = false;				// render thread only, textures or pages came in since the last frame
+
+	// one node for the model, one child per mesh with the mesh index as user data
+	Scene scene;
+	int modelNode = -1;
+	std::vector<int> meshNodes;
+	std::vector<int> visibleNodes;
+	// render thread only, mesh index -> its pose this frame and the bounds of the posed mesh
+	struct MeshPose
+	{
+		std::vector<Matrix4f> bones;
+		Vector3f boundCenter;
+		float boundRadius = 0.f;
+	};
+	std::vector<MeshPose> meshPoses;
+
+	// screen rects of the draws of the last frames, render thread only
+	DirtyRegion dirtyRegion;
+	uint64_t frameSignature = 0;		// of what every pixel depends on
+	uint64_t drawsSignature = 0;		// of the nodes drawn this frame
+
+	// debug: how many frames in a row drew the same at the same settings, they must not allocate
+	uint64_t steadySignature = 0;
+	int steadyFrames = 0;
+
+	// written by the main thread, read by the render thread
+	FrameInput input;
+	std::mutex inputMutex;
 
 	bool hasInited = false;
 	unsigned int width = 700;
 	unsigned int height = 700;
+	int framesInFlight = 2;
 
 	std::chrono::system_clock::time_point initTime;
 };
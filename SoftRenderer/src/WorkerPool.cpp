@@ -0,0 +1,90 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(int workers)
+{
+	if (workers < 0)
+		workers = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	for (int i = 0; i < workers; ++i)
+		threads.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		quit = true;
+	}
+	cv.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void WorkerPool::work()
+{
+	int seen = 0;
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true)
+	{
+		cv.wait(lock, [&] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+
+		lock.unlock();
+		while (runBand())
+			;
+		lock.lock();
+	}
+}
+
+// false once every band of the job is taken
+bool WorkerPool::runBand()
+{
+	int band;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (nextBand >= bandCount)
+			return false;
+		band = nextBand++;
+	}
+
+	// the job can't change before its last band is done
+	int begin = band * bandSize;
+	jobFunc(jobContext, begin, std::min(jobCount, begin + bandSize));
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (++bandsDone == bandCount)
+		doneCv.notify_all();
+	return true;
+}
+
+void WorkerPool::parallelFor(int count, void (*func)(void*, int, int), void* context, int size)
+{
+	if (count <= 0)
+		return;
+	if (threads.empty())
+	{
+		func(context, 0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		jobFunc = func;
+		jobContext = context;
+		jobCount = count;
+		int bands = getThreadCount() * 4;
+		bandSize = size > 0 ? size : std::max((count + bands - 1) / bands, 1);
+		bandCount = (count + bandSize - 1) / bandSize;
+		nextBand = 0;
+		bandsDone = 0;
+		++generation;
+	}
+	cv.notify_all();
+
+	while (runBand())
+		;
+	std::unique_lock<std::mutex> lock(mtx);
+	doneCv.wait(lock, [&] { return bandsDone == bandCount; });
+}
\ No newline at end of file
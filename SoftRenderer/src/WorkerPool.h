@@ -0,0 +1,52 @@
+#ifndef M_WORKER_POOL_H
+#define M_WORKER_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// threads that wait for loops to split: parallelFor hands out bands of the index range to them and to
+// the calling thread, and returns once all are done. one loop at a time, the pool is not for several callers
+class WorkerPool
+{
+public:
+	// workers : besides the calling thread, -1 for one per other core
+	explicit WorkerPool(int workers = -1);
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	int getThreadCount() const { return static_cast<int>(threads.size()) + 1; };
+
+	// calls func(begin, end) on bands of [0, count) until all are done,
+	// bandSize 0 cuts a few bands per thread so a slow band does not keep the others waiting
+	template<typename Func>
+	void parallelFor(int count, Func& func, int bandSize = 0)
+	{
+		parallelFor(count, [](void* context, int begin, int end) { (*static_cast<Func*>(context))(begin, end); }, &func, bandSize);
+	};
+	void parallelFor(int count, void (*func)(void*, int, int), void* context, int bandSize = 0);
+
+private:
+	void work();
+	bool runBand();
+
+	std::vector<std::thread> threads;
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::condition_variable doneCv;
+	bool quit = false;
+	int generation = 0;				// of the job, a worker takes bands of each one once
+
+	// the current job
+	void (*jobFunc)(void*, int, int) = nullptr;
+	void* jobContext = nullptr;
+	int jobCount = 0;
+	int bandSize = 0;
+	int nextBand = 0;
+	int bandCount = 0;
+	int bandsDone = 0;
+};
+
+#endif
\ No newline at end of file
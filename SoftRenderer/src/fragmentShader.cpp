@@ -1,19 +1,31 @@
 #include "fragmentShader.h"
+#include "ShadowMap.h"
+#include "vertexShader.h"
+#include "VirtualTexture.h"
 
-Vector4f fragmentShader(FragmentShaderParams& param)
+// [0, 1], from the virtual texture when the texture streams. the footprint of the pixel covers
+// the whole block of a coarse shading rate. false while the texture is still loading
+static bool sampleTexture(const FragmentShaderParams& param, int idx, const Vector2f& uv, Vector3f& col)
 {
-	auto uv = param.uv;
-	// auto t = param.diffuseTexture.getColorFromUV(uv.x, uv.y);
-	/*return param.color;*/
-
-	Vector3f col = { 0, 0, 0 };
-
-	//auto diffcol = static_cast<Vector3f>(param.diffuseTexture.getColorFromUV(uv.x, uv.y));
-	Vector3f La = param.Ka.mulByVector(Vector3f{ 10, 10, 10 });
-	//param.Kd = Vector3f{125, 125, 125} / 255.f;
-	//param.Ks = Vector3f(0.7937, 0.7937, 0.7937);
-	//param.Ns = 150;
+	if (idx < static_cast<int>(param.virtualTextureVec.size()) && param.virtualTextureVec[idx])
+	{
+		float dudx, dudy, dvdx, dvdy;
+		param.getDerivatives(DefaultVaryings::UV, dudx, dudy);
+		param.getDerivatives(DefaultVaryings::UV + 1, dvdx, dvdy);
+		float rate = static_cast<float>(param.shadingRate);
+		col = static_cast<Vector3f>(param.virtualTextureVec[idx]->sample(uv.x, uv.y, dudx * rate, dvdx * rate, dudy * rate, dvdy * rate)) / 255.f;
+		return true;
+	}
+	if (idx >= static_cast<int>(param.textureVec.size()) || !param.textureVec[idx])
+		return false;
+	col = static_cast<Vector3f>(param.textureVec[idx]->getColorFromUV(uv.x, uv.y)) / 255.f;
+	return true;
+}
 
+// uv wrapped once into [0, 1)
+static Vector2f wrapUv(const float* in)
+{
+	Vector2f uv = { in[DefaultVaryings::UV], in[DefaultVaryings::UV + 1] };
 	if (uv.x < 0.0f)
 		uv.x += 1.0f;
 	else if (uv.x >= 1.0f)
@@ -23,33 +35,99 @@ Vector4f fragmentShader(FragmentShaderParams& param)
 		uv.y += 1.0f;
 	else if (uv.y >= 1.0f)
 		uv.x -= 1.0f;
+	return uv;
+}
 
-	if (param.diffuseTextureIdx != -1)
-	{
-		param.Kd = static_cast<Vector3f>(param.textureVec[param.diffuseTextureIdx]->getColorFromUV(uv.x, uv.y)) / 255.f;
-	}
+// blinn-phong of the lights on top of the ambient color La, [0, 1] per light
+static inline Vector3f shadeLights(const FragmentShaderParams& param, const Vector3f& normal, const Vector3f& viewPos3,
+	const Vector3f& La, const Vector3f& Kd, const Vector3f& Ks, float Ns)
+{
+	auto view = (Vector3f{ 0, 0, 0 } - viewPos3).normalize();
 
-	if (param.specularTextureIdx != -1)
-	{
-		param.Ks = static_cast<Vector3f>(param.textureVec[param.specularTextureIdx]->getColorFromUV(uv.x, uv.y)) / 255.f;
-	}
+	// ambient is added once, it can't depend on how many lights survived culling
+	Vector3f col = La;
 
-	auto viewPos3 = static_cast<Vector3f>(param.viewPos);
-	for (int i = 0; i < param.lights.size(); ++i)
+	// only the lights touching this screen tile, if the renderer has culled them
+	int lightCount = param.tileLights != nullptr ? param.tileLightCount : static_cast<int>(param.lights.size());
+	for (int k = 0; k < lightCount; ++k)
 	{
-		auto view = (Vector3f{ 0, 0, 0 } - viewPos3).normalize();
-		auto light = (param.lights[i].position - viewPos3);
+		const auto& l = param.lights[param.tileLights != nullptr ? param.tileLights[k] : k];
+		auto light = (l.position - viewPos3);
 		auto r_2 = light.squreLen();
-		auto I_r2 = param.lights[i].intensity / r_2;
+		if (r_2 >= l.radius * l.radius)
+			continue;
+		auto I_r2 = l.attenuation(r_2) * l.intensity;
+		if (l.shadowMapIdx != -1)
+		{
+			auto lit = param.shadowMaps[l.shadowMapIdx]->visibility(viewPos3);
+			if (lit <= 0.f)
+				continue;
+			I_r2 = lit * I_r2;
+		}
 
 		light = light.normalize();
 		auto h = (view + light).normalize();
 		
-		auto Ld = std::max(0.f, param.normal.dotProduct(light)) * param.Kd.mulByVector(I_r2);
-		auto Ls = std::powf(std::max(0.f, param.normal.dotProduct(h)), param.Ns) * param.Ks.mulByVector(I_r2);
+		auto Ld = std::max(0.f, normal.dotProduct(light)) * Kd.mulByVector(I_r2);
+		auto Ls = std::powf(std::max(0.f, normal.dotProduct(h)), Ns) * Ks.mulByVector(I_r2);
 
-		col = col + La + Ld + Ls;
+		col = col + Ld + Ls;
 	}
+	return col;
+}
 
-	return static_cast<Vector4f>(255 * col);
+Vector4f fragmentShader(FragmentShaderParams& param)
+{
+	const float* in = param.varyings;
+	auto normal = Vector3f(in[DefaultVaryings::NORMAL], in[DefaultVaryings::NORMAL + 1], in[DefaultVaryings::NORMAL + 2]).normalize();
+	auto viewPos3 = Vector3f(in[DefaultVaryings::VIEW_POS], in[DefaultVaryings::VIEW_POS + 1], in[DefaultVaryings::VIEW_POS + 2]);
+	Vector2f uv = wrapUv(in);
+
+	Vector3f La = param.Ka.mulByVector(Vector3f{ Material::AMBIENT_INTENSITY, Material::AMBIENT_INTENSITY, Material::AMBIENT_INTENSITY });
+
+	// the material color stands in for a texture that is not loaded yet
+	Vector3f Kd = param.Kd;
+	if (param.diffuseTextureIdx != -1)
+		sampleTexture(param, param.diffuseTextureIdx, uv, Kd);
+
+	Vector3f Ks = param.Ks;
+	if (param.specularTextureIdx != -1)
+		sampleTexture(param, param.specularTextureIdx, uv, Ks);
+
+	return static_cast<Vector4f>(255 * shadeLights(param, normal, viewPos3, La, Kd, Ks, param.Ns));
+}
+
+// fragmentShader with the maps fixed at compile time and the constants precomputed in param.material
+template<int Features>
+static Vector4f materialShader(FragmentShaderParams& param)
+{
+	const MaterialUniforms& material = *param.material;
+	const float* in = param.varyings;
+	auto normal = Vector3f(in[DefaultVaryings::NORMAL], in[DefaultVaryings::NORMAL + 1], in[DefaultVaryings::NORMAL + 2]).normalize();
+	auto viewPos3 = Vector3f(in[DefaultVaryings::VIEW_POS], in[DefaultVaryings::VIEW_POS + 1], in[DefaultVaryings::VIEW_POS + 2]);
+
+	Vector3f Kd = material.Kd;
+	Vector3f Ks = material.Ks;
+	if constexpr (Features != Material::Untextured)
+	{
+		Vector2f uv = wrapUv(in);
+		// the material color stands in for a texture that is not loaded yet
+		if constexpr ((Features & Material::DiffuseMap) != 0)
+			sampleTexture(param, material.diffuseTextureIdx, uv, Kd);
+		if constexpr ((Features & Material::SpecularMap) != 0)
+			sampleTexture(param, material.specularTextureIdx, uv, Ks);
+	}
+
+	return static_cast<Vector4f>(255 * shadeLights(param, normal, viewPos3, material.ambient, Kd, Ks, material.Ns));
+}
+
+MaterialShader getMaterialShader(int features)
+{
+	static const MaterialShader variants[Material::FEATURE_COUNT] = {
+		materialShader<Material::Untextured>,
+		materialShader<Material::DiffuseMap>,
+		materialShader<Material::SpecularMap>,
+		materialShader<Material::DiffuseMap | Material::SpecularMap>,
+	};
+	return variants[features & (Material::FEATURE_COUNT - 1)];
 }
\ No newline at end of file
@@ -3,7 +3,11 @@
 
 #include "Math.h"
 #include "Renderer.h"
+#include "Material.h"
 
+// reads the material constants and texture indices of param, whatever the draw
 Vector4f fragmentShader(FragmentShaderParams& param);
+// the variant of fragmentShader for a mask of Material::Feature, reading param.material
+MaterialShader getMaterialShader(int features);
 
 #endif
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <string>
+#include <cstdlib>
 #include "Window.h"
 #include "Math.h"
 #include "Model.h"
@@ -9,7 +11,58 @@ int main(int argc, char *args[])
 	//t.run();
 
 	Window win;
-	win.loop();
+	// SoftRenderer [--texture-budget <MB>] [--compact-vertices] [--depth-format d16|d24|d32f] ...
+	// streams the textures within MB megabytes, stores the vertices quantized, stores depth as d32f by default
+	while (argc > 1)
+	{
+		std::string option = args[1];
+		if (option == "--texture-budget" && argc > 2)
+		{
+			win.setTextureBudget(std::atoi(args[2]));
+			args += 2;
+			argc -= 2;
+		}
+		else if (option == "--compact-vertices")
+		{
+			win.setCompactVertices(true);
+			args += 1;
+			argc -= 1;
+		}
+		else if (option == "--depth-format" && argc > 2)
+		{
+			std::string format = args[2];
+			if (format == "d16")
+				win.setDepthFormat(DepthFormat::D16);
+			else if (format == "d24")
+				win.setDepthFormat(DepthFormat::D24);
+			else if (format == "d32f")
+				win.setDepthFormat(DepthFormat::D32F);
+			else
+			{
+				printf("--depth-format: expected d16, d24 or d32f, got %s\n", args[2]);
+				return 1;
+			}
+			args += 2;
+			argc -= 2;
+		}
+		else
+		{
+			break;
+		}
+	}
+	// SoftRenderer --batch <dir> <frames> [fps] renders the animation to images instead, with whole textures
+	if (argc > 3 && std::string(args[1]) == "--batch")
+	{
+		float fps = argc > 4 ? static_cast<float>(std::atof(args[4])) : 30.f;
+		if (!(fps > 0.f))
+		{
+			printf("--batch: fps must be a positive number, got %s\n", args[4]);
+			return 1;
+		}
+		win.renderClip(args[2], std::atoi(args[3]), fps);
+	}
+	else
+		win.loop();
 
 	return 0;
 }
\ No newline at end of file
@@ -9,7 +9,17 @@ Vector4f vectexShader(VertexShaderParams& param)
 
 	// caculate the point normal in view space
 	auto tnormal = param.mv_i_T * static_cast<Vector4f>(param.pointNormal);
-	param.pointNormal = static_cast<Vector3f>(tnormal);
+	auto normal = static_cast<Vector3f>(tnormal).normalize();
+
+	float* out = param.varyings;
+	out[DefaultVaryings::UV] = param.uv.x;
+	out[DefaultVaryings::UV + 1] = param.uv.y;
+	out[DefaultVaryings::NORMAL] = normal.x;
+	out[DefaultVaryings::NORMAL + 1] = normal.y;
+	out[DefaultVaryings::NORMAL + 2] = normal.z;
+	out[DefaultVaryings::VIEW_POS] = t.x;
+	out[DefaultVaryings::VIEW_POS + 1] = t.y;
+	out[DefaultVaryings::VIEW_POS + 2] = t.z;
 
 	return param.p * t;
 }
\ No newline at end of file
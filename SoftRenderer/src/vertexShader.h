@@ -4,6 +4,15 @@
 #include "Math.h"
 #include "Renderer.h"
 
+// varyings written by vectexShader and read by fragmentShader
+namespace DefaultVaryings
+{
+	const int UV = 0;			// 2 floats
+	const int NORMAL = 2;		// 3 floats, view space
+	const int VIEW_POS = 5;		// 3 floats
+	const int COUNT = 8;
+}
+
 Vector4f vectexShader(VertexShaderParams& param);
 
 #endif
\ No newline at end of file